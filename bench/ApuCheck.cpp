@@ -0,0 +1,228 @@
+// Checks the APU against hardware behaviour by driving its registers directly: NR52
+// status bits and power off, DAC off, length expiry, sweep overflow, the pitch of a
+// square tone and the number of samples produced per emulated second. Null audio must
+// show the same register timing. Prints the failed checks, exits with 1 if there are any.
+//
+// Usage: apu_check
+
+#include "emu/Sound.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+enum {
+    ClockRate = 4194304,
+    FrameCycles = 70224,
+    LengthClockCycles = 16384,  // the frame sequencer clocks lengths at 256 Hz
+    SweepClockCycles = 32768,   // and the sweep at 128 Hz
+};
+
+class NullLogger : public Logger {
+protected:
+    virtual void logImpl(const char* format, ...) override {
+    }
+};
+
+// A Sound with its own clock, which reads out the samples of each emulated frame
+class Apu {
+    NullLogger log;
+    long clock;
+    Sound sound;
+    unsigned long samplesRead;
+    std::vector<int16_t> left;      // kept only if recording
+
+public:
+    bool recording;
+
+    explicit Apu(bool nullAudio = false) :
+            clock(0),
+            sound(&log, &clock),
+            samplesRead(0),
+            recording(false) {
+        sound.setNullAudio(nullAudio);
+        sound.endFrame();
+    }
+
+    void write(Byte reg, Byte value) {
+        sound.registerAccess(0xff00 | reg, &value, true);
+    }
+
+    Byte read(Byte reg) {
+        Byte value = 0;
+        sound.registerAccess(0xff00 | reg, &value, false);
+        return value;
+    }
+
+    void run(long cycles) {
+        while (cycles > 0) {
+            long step = std::min(cycles, (long)FrameCycles);
+            clock += step;
+            cycles -= step;
+
+            sound.endFrame();
+            StereoSample samples[1024];
+            while (unsigned count = sound.readSamples(samples, 1024)) {
+                samplesRead += count;
+                for (unsigned i = 0; recording && i < count; i++) {
+                    left.push_back(samples[i].left);
+                }
+            }
+        }
+    }
+
+    unsigned long getSamplesRead() { return samplesRead; }
+    const std::vector<int16_t>& getLeft() { return left; }
+
+    // Powers on with all channels at full volume on both sides
+    void powerOn() {
+        write(Snd_Ctrl_Stat, 0x80);
+        write(Snd_Ctrl_Volume, 0x77);
+        write(Snd_Ctrl_ChSel, 0xff);
+    }
+
+    // Triggers channel 1 at frequency register value freq
+    void triggerSquare1(Word freq, bool lengthEnabled) {
+        write(Snd_Ch1_Envelope, 0xf0);
+        write(Snd_Ch1_FreqLo, freq & 0xff);
+        write(Snd_Ch1_FreqHi, 0x80 | (lengthEnabled ? 0x40 : 0) | (freq >> 8));
+    }
+
+    bool isEnabled(unsigned channel) { return read(Snd_Ctrl_Stat) & (1 << channel); }
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL  %s\n", what);
+        failures++;
+    }
+}
+
+static void checkStatus() {
+    Apu apu;
+    check(apu.read(Snd_Ctrl_Stat) == 0x70, "NR52 reads 0x70 at reset");
+    apu.powerOn();
+    check(apu.read(Snd_Ctrl_Stat) == 0xf0, "NR52 reads 0xf0 once powered on");
+
+    apu.triggerSquare1(1798, false);
+    apu.write(Snd_Ch2_Envelope, 0xf0);
+    apu.write(Snd_Ch2_FreqHi, 0x87);
+    check(apu.read(Snd_Ctrl_Stat) == 0xf3, "NR52 reports triggered channels 1 and 2");
+
+    apu.write(Snd_Ch2_Envelope, 0x00);
+    check(apu.read(Snd_Ctrl_Stat) == 0xf1, "turning the DAC off disables channel 2");
+
+    apu.write(Snd_Ch2_Envelope, 0xf0);
+    apu.write(Snd_Ch2_FreqHi, 0x87);
+    apu.write(Snd_Ctrl_Stat, 0x00);
+    check(apu.read(Snd_Ctrl_Stat) == 0x70, "powering off disables all channels");
+    check(apu.read(Snd_Ch1_Envelope) == 0, "powering off clears the registers");
+
+    apu.write(Snd_Ch1_Envelope, 0xf0);
+    check(apu.read(Snd_Ch1_Envelope) == 0, "writes are ignored while powered off");
+    apu.write(Snd_Ch3_WaveRam, 0x5a);
+    check(apu.read(Snd_Ch3_WaveRam) == 0x5a, "wave RAM stays writable while powered off");
+}
+
+// Returns the NR52 readings every LengthClockCycles / 4 cycles, so that null audio can be compared
+static std::vector<Byte> checkLength(bool nullAudio) {
+    std::vector<Byte> statuses;
+    Apu apu(nullAudio);
+    apu.powerOn();
+
+    // A length of 64 expires after 64 length clocks, the first of which comes within one period
+    apu.write(Snd_Ch1_Wave, 0x80);
+    apu.triggerSquare1(1798, true);
+    for (unsigned i = 0; i < 65 * 4; i++) {
+        if (i == 63 * 4) {
+            check(apu.isEnabled(0), "channel 1 still plays before 64 length clocks");
+        }
+        statuses.push_back(apu.read(Snd_Ctrl_Stat));
+        apu.run(LengthClockCycles / 4);
+    }
+    check(!apu.isEnabled(0), "channel 1 stops after 64 length clocks");
+
+    // Retriggering after expiry reloads the full length
+    apu.triggerSquare1(1798, true);
+    check(apu.isEnabled(0), "retriggering restarts channel 1");
+    apu.run(LengthClockCycles * 2);
+    check(apu.isEnabled(0), "retriggering reloads the length");
+
+    // A length of 1 expires at the next length clock
+    apu.write(Snd_Ch1_Wave, 0xbf);
+    apu.run(LengthClockCycles);
+    check(!apu.isEnabled(0), "channel 1 stops after a length of 1");
+    statuses.push_back(apu.read(Snd_Ctrl_Stat));
+
+    // Without length enabled, the counter doesn't run
+    apu.write(Snd_Ch1_Wave, 0xbf);
+    apu.triggerSquare1(1798, false);
+    apu.run(LengthClockCycles * 70);
+    check(apu.isEnabled(0), "channel 1 keeps playing with length disabled");
+    statuses.push_back(apu.read(Snd_Ctrl_Stat));
+
+    check(nullAudio ? apu.getSamplesRead() == 0 : apu.getSamplesRead() > 0,
+            nullAudio ? "null audio produces no samples" : "samples are produced");
+    return statuses;
+}
+
+static void checkSweep() {
+    Apu apu;
+    apu.powerOn();
+
+    // 1500 + 1500 / 2 overflows 2047 already in the check done by the trigger
+    apu.write(Snd_Ch1_Sweep, 0x11);
+    apu.triggerSquare1(1500, false);
+    check(!apu.isEnabled(0), "sweep overflow at trigger disables channel 1");
+
+    // 1200 -> 1800 at the first sweep clock, then the check of 1800 + 900 overflows
+    apu.triggerSquare1(1200, false);
+    check(apu.isEnabled(0), "channel 1 starts when the sweep doesn't overflow yet");
+    apu.run(SweepClockCycles * 2);
+    check(!apu.isEnabled(0), "sweep overflow after a sweep clock disables channel 1");
+
+    // Decreasing sweeps never overflow
+    apu.write(Snd_Ch1_Sweep, 0x19);
+    apu.triggerSquare1(1200, false);
+    apu.run(SweepClockCycles * 10);
+    check(apu.isEnabled(0), "decreasing sweep keeps channel 1 playing");
+}
+
+static void checkOutput() {
+    Apu apu;
+    apu.recording = true;
+    apu.powerOn();
+    apu.write(Snd_Ch1_Wave, 0x80);     // 50% duty
+    apu.triggerSquare1(1798, false);    // 131072 / (2048 - 1798) = 524.288 Hz
+
+    const unsigned frames = 120;
+    apu.run((long)frames * FrameCycles);
+
+    double expectedSamples = (double)frames * FrameCycles * Sound::SampleRate / ClockRate;
+    check(std::fabs(apu.getSamplesRead() - expectedSamples) <= 2, "samples produced match the emulated time");
+
+    // Counts rising zero crossings after the first half second, once the DC offset has settled
+    const std::vector<int16_t>& left = apu.getLeft();
+    unsigned start = Sound::SampleRate / 2, crossings = 0;
+    int16_t peak = 0;
+    for (size_t i = start; i < left.size(); i++) {
+        crossings += left[i - 1] < 0 && left[i] >= 0;
+        peak = std::max(peak, left[i]);
+    }
+    double frequency = crossings / ((left.size() - start) / (double)Sound::SampleRate);
+    check(std::fabs(frequency - 524.288) < 524.288 * 0.01, "square tone plays at its frequency");
+    check(peak > 1000, "square tone is audible");
+}
+
+int main() {
+    checkStatus();
+    std::vector<Byte> statuses = checkLength(false);
+    check(checkLength(true) == statuses, "null audio keeps NR52 timing");
+    checkSweep();
+    checkOutput();
+
+    printf("%s\n", failures ? "APU checks failed" : "APU checks passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,95 @@
+// Measures the throughput of the audio resampler for each quality level and common host
+// rates, and checks the vectorized dot product against the scalar reference version.
+//
+// Usage: resampler_bench [seconds of audio]
+
+#include "emu/Resampler.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+enum {
+    InputRate = 48000,
+    BlockSamples = 1024,
+};
+
+// Something that sounds like the APU: a square wave, a triangle-ish wave and some noise
+static void makeTestSignal(std::vector<StereoSample>& samples) {
+    srand(1);
+    for (size_t i = 0; i < samples.size(); i++) {
+        int square = (i / 55) % 2 ? 6000 : -6000;
+        int wave = (int)(5000 * std::sin(2 * M_PI * 523.25 * i / InputRate));
+        int noise = rand() % 2000 - 1000;
+        samples[i].left = (int16_t)(square + wave);
+        samples[i].right = (int16_t)(square / 2 + noise);
+    }
+}
+
+// Resamples the whole input in blocks, like the frontend does
+static size_t run(Resampler& resampler, Resampler::DotFn dotFn, const std::vector<StereoSample>& in,
+        std::vector<StereoSample>& out) {
+    size_t produced = 0;
+    for (size_t i = 0; i < in.size(); i += BlockSamples) {
+        resampler.write(&in[i], (unsigned)std::min<size_t>(BlockSamples, in.size() - i));
+        produced += resampler.read(&out[produced], (unsigned)(out.size() - produced), dotFn);
+    }
+    return produced;
+}
+
+static double measure(ResamplerQuality quality, unsigned outputRate, Resampler::DotFn dotFn,
+        const std::vector<StereoSample>& in, std::vector<StereoSample>& out) {
+    Resampler resampler(InputRate, outputRate, quality);
+    auto start = std::chrono::steady_clock::now();
+    size_t produced = run(resampler, dotFn, in, out);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return produced / elapsed.count() / 1e6;
+}
+
+int main(int argc, char** argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 20;
+
+    static const struct {
+        ResamplerQuality quality;
+        const char* name;
+    } qualities[] = {
+            { Resampler_Fast, "fast" },
+            { Resampler_Medium, "medium" },
+            { Resampler_Best, "best" },
+    };
+    static const unsigned outputRates[] = { 44100, 48000, 96000 };
+
+    std::vector<StereoSample> in((size_t)InputRate * seconds);
+    std::vector<StereoSample> reference(in.size() * 2 + BlockSamples), out(reference.size());
+    makeTestSignal(in);
+
+    int failures = 0;
+    printf("%-8s %6s %14s %14s\n", "quality", "rate", "scalar MS/s", "best MS/s");
+    for (const auto& quality : qualities) {
+        for (unsigned outputRate : outputRates) {
+            Resampler scalar(InputRate, outputRate, quality.quality), best(InputRate, outputRate, quality.quality);
+            size_t count = run(scalar, Resampler::dotScalar, in, reference);
+            if (run(best, nullptr, in, out) != count) {
+                printf("%-8s %6u vectorized output has a different length!\n", quality.name, outputRate);
+                failures++;
+            }
+            // Summing in a different order may round differently, but never by much
+            for (size_t i = 0; i < count; i++) {
+                if (std::abs(reference[i].left - out[i].left) > 1 || std::abs(reference[i].right - out[i].right) > 1) {
+                    printf("%-8s %6u vectorized output differs from the scalar version!\n", quality.name, outputRate);
+                    failures++;
+                    break;
+                }
+            }
+
+            double scalarRate = measure(quality.quality, outputRate, Resampler::dotScalar, in, out);
+            double bestRate = measure(quality.quality, outputRate, nullptr, in, out);
+            printf("%-8s %6u %14.2f %14.2f\n", quality.name, outputRate, scalarRate, bestRate);
+        }
+    }
+    printf("(output megasamples per second, stereo, from %u Hz)\n", (unsigned)InputRate);
+
+    return failures ? 1 : 0;
+}
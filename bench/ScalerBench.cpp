@@ -0,0 +1,80 @@
+// Measures the throughput of the CPU scalers, and checks the vectorized versions
+// against the scalar reference versions.
+//
+// Usage: scaler_bench [iterations]
+
+#include "emu/Scalers.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+enum {
+    Width = 160,
+    Height = 144,
+};
+
+// Something that looks like a Game Boy screen: flat areas, hard edges and a few colors
+static void makeTestFrame(uint32_t* frame) {
+    static const uint32_t palette[] = { 0xffffff, 0xaaaaaa, 0x555555, 0x000000, 0xf8d020, 0x3060f8 };
+    srand(1);
+    for (unsigned y = 0; y < Height; y++) {
+        for (unsigned x = 0; x < Width; x++) {
+            unsigned color = ((x / 8) ^ (y / 8)) % 4;
+            if ((x % 8) * (y % 8) > 20 && rand() % 3 == 0) {
+                color = 4 + rand() % 2;
+            }
+            frame[y * Width + x] = palette[color];
+        }
+    }
+}
+
+static double measure(ScalerType type, Scalers::RowFn rowFn, const uint32_t* src, uint32_t* dst, int iterations) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        Scalers::scale(type, src, Width, Height, dst, 0, Height, rowFn);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    unsigned factor = Scalers::getScaleFactor(type);
+    return (double)Width * Height * factor * factor * iterations / elapsed.count() / 1e6;
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+
+    static const struct {
+        ScalerType type;
+        const char* name;
+        Scalers::RowFn scalar;
+    } scalers[] = {
+            { Scaler_Scale2x, "scale2x", Scalers::scale2xRowScalar },
+            { Scaler_Scale3x, "scale3x", Scalers::scale3xRowScalar },
+            { Scaler_Hq2x, "hq2x", Scalers::hq2xRowScalar },
+    };
+
+    std::vector<uint32_t> src(Width * Height);
+    std::vector<uint32_t> reference(Width * Height * 9), dst(Width * Height * 9);
+    makeTestFrame(&src[0]);
+
+    int failures = 0;
+    printf("%-10s %14s %14s\n", "filter", "scalar MP/s", "best MP/s");
+    for (const auto& scaler : scalers) {
+        Scalers::scale(scaler.type, &src[0], Width, Height, &reference[0], 0, Height, scaler.scalar);
+        Scalers::scale(scaler.type, &src[0], Width, Height, &dst[0], 0, Height);
+        unsigned factor = Scalers::getScaleFactor(scaler.type);
+        if (memcmp(&reference[0], &dst[0], Width * Height * factor * factor * sizeof(uint32_t))) {
+            printf("%-10s vectorized output differs from the scalar version!\n", scaler.name);
+            failures++;
+        }
+
+        double scalarRate = measure(scaler.type, scaler.scalar, &src[0], &dst[0], iterations / 4 + 1);
+        double bestRate = measure(scaler.type, nullptr, &src[0], &dst[0], iterations);
+        printf("%-10s %14.1f %14.1f\n", scaler.name, scalarRate, bestRate);
+    }
+    printf("(output megapixels per second)\n");
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,197 @@
+#include "AudioDumper.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+static void putLittleEndian(Byte* p, uint32_t value, unsigned bytes) {
+    for (unsigned i = 0; i < bytes; i++) {
+        p[i] = (Byte)(value >> (8 * i));
+    }
+}
+
+static bool endsWith(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// out.wav -> out.ch1.wav, out -> out.ch1
+static std::string stemPath(const std::string& path, unsigned channel) {
+    std::string suffix = ".ch" + std::to_string(channel + 1);
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return path + suffix;
+    }
+    return path.substr(0, dot) + suffix + path.substr(dot);
+}
+
+AudioDumper::AudioDumper(const std::string& path, unsigned sampleRate, bool stems) :
+        wav(endsWith(path, ".wav")),
+        stems(stems),
+        sampleRate(sampleRate),
+        failed(false),
+        ring(new SpscQueue<DumpSample, RingSamples>()),
+        samplesReady(false),
+        quit(false),
+        finished(false) {
+    for (unsigned i = 0; i < 5; i++) {
+        files[i] = DumpFile { nullptr, i ? 1u : 2u, 0 };
+        if (i && !stems) {
+            continue;
+        }
+        files[i].file = fopen(i ? stemPath(path, i - 1).c_str() : path.c_str(), "wb");
+        if (!files[i].file) {
+            for (unsigned j = 0; j < i; j++) {
+                if (files[j].file) {
+                    fclose(files[j].file);
+                }
+            }
+            throw "Can't open audio dump file";
+        }
+        if (wav) {
+            // Sizes are filled in by finish()
+            writeWavHeader(files[i]);
+        }
+    }
+
+    thread = std::thread(&AudioDumper::run, this);
+}
+
+AudioDumper::~AudioDumper() {
+    finish();
+}
+
+void AudioDumper::write(const StereoSample* mix, const int16_t* const* channels, unsigned count) {
+    DumpSample chunk[256];
+    for (unsigned done = 0; done < count; ) {
+        unsigned n = std::min(count - done, (unsigned)arraySize(chunk));
+        for (unsigned i = 0; i < n; i++) {
+            chunk[i].mix = mix[done + i];
+            for (unsigned c = 0; c < 4; c++) {
+                chunk[i].stems[c] = channels ? channels[c][done + i] : 0;
+            }
+        }
+
+        size_t pushed = ring->push(chunk, n);
+        while (pushed < n) {
+            // The writer fell behind: wait for it rather than lose samples
+            std::unique_lock<std::mutex> lock(mutex);
+            samplesReady = true;
+            wakeup.notify_one();
+            drained.wait(lock, [this] { return ring->size() < RingSamples; });
+            lock.unlock();
+            pushed += ring->push(chunk + pushed, n - pushed);
+        }
+        done += n;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        samplesReady = true;
+    }
+    wakeup.notify_one();
+}
+
+bool AudioDumper::finish() {
+    if (finished) {
+        return !failed;
+    }
+    finished = true;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wakeup.notify_one();
+    thread.join();
+
+    for (DumpFile& file : files) {
+        if (!file.file) {
+            continue;
+        }
+        if (wav && fseek(file.file, 0, SEEK_SET) == 0) {
+            writeWavHeader(file);
+        }
+        if (fclose(file.file)) {
+            failed = true;
+        }
+        file.file = nullptr;
+    }
+    return !failed;
+}
+
+void AudioDumper::run() {
+    std::vector<DumpSample> batch(BatchSamples);
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wakeup.wait(lock, [this] { return samplesReady || quit; });
+        samplesReady = false;
+        bool quitting = quit;
+        lock.unlock();
+
+        // Once quitting, the emulation thread doesn't push anymore: this drains the ring
+        while (size_t count = ring->pop(&batch[0], batch.size())) {
+            {
+                std::lock_guard<std::mutex> drainedLock(mutex);
+            }
+            drained.notify_one();
+            writeBatch(&batch[0], (unsigned)count);
+        }
+        if (quitting) {
+            return;
+        }
+
+        lock.lock();
+    }
+}
+
+void AudioDumper::writeBatch(const DumpSample* samples, unsigned count) {
+    Byte data[BatchSamples * 4];
+    for (unsigned i = 0; i < count; i++) {
+        putLittleEndian(&data[i * 4], (uint16_t)samples[i].mix.left, 2);
+        putLittleEndian(&data[i * 4 + 2], (uint16_t)samples[i].mix.right, 2);
+    }
+    writeData(files[0], data, count * 4);
+
+    if (!stems) {
+        return;
+    }
+    for (unsigned c = 0; c < 4; c++) {
+        for (unsigned i = 0; i < count; i++) {
+            putLittleEndian(&data[i * 2], (uint16_t)samples[i].stems[c], 2);
+        }
+        writeData(files[c + 1], data, count * 2);
+    }
+}
+
+void AudioDumper::writeData(DumpFile& file, const void* data, size_t size) {
+    if (fwrite(data, 1, size, file.file) != size) {
+        failed = true;
+    }
+    file.dataBytes += size;
+}
+
+void AudioDumper::writeWavHeader(DumpFile& file) {
+    // Sizes are capped, WAV files can't be any larger
+    uint32_t dataBytes = (uint32_t)std::min<uint64_t>(file.dataBytes, 0xffffffffu - 36);
+    unsigned blockAlign = file.channels * 2;
+
+    Byte header[44];
+    std::memcpy(&header[0], "RIFF", 4);
+    putLittleEndian(&header[4], 36 + dataBytes, 4);
+    std::memcpy(&header[8], "WAVEfmt ", 8);
+    putLittleEndian(&header[16], 16, 4);                        // fmt chunk size
+    putLittleEndian(&header[20], 1, 2);                         // PCM
+    putLittleEndian(&header[22], file.channels, 2);
+    putLittleEndian(&header[24], sampleRate, 4);
+    putLittleEndian(&header[28], sampleRate * blockAlign, 4);   // bytes per second
+    putLittleEndian(&header[32], blockAlign, 2);
+    putLittleEndian(&header[34], 16, 2);                        // bits per sample
+    std::memcpy(&header[36], "data", 4);
+    putLittleEndian(&header[40], dataBytes, 4);
+
+    if (fwrite(header, 1, sizeof(header), file.file) != sizeof(header)) {
+        failed = true;
+    }
+}
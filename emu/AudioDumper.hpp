@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Platform.hpp"
+#include "Sound.hpp"
+#include "SpscQueue.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Writes the mixed sound output, and optionally a mono stem per channel, to WAV files (if the
+// path ends in .wav) or raw 16-bit little endian PCM files. Stems go next to the mix, as
+// name.ch1.wav etc. The emulation thread hands samples over through a lock-free ring, and a
+// thread of its own does the file I/O. If that thread falls behind by more than the ring
+// holds, write() waits for it instead of dropping samples, so dumps are complete even when
+// emulating at uncapped speed.
+class AudioDumper {
+    enum {
+        RingSamples = 1 << 16,      // over a second of sound
+        BatchSamples = 4096,
+    };
+
+    struct DumpSample {
+        StereoSample mix;
+        int16_t stems[4];
+    };
+
+    struct DumpFile {
+        FILE* file;
+        unsigned channels;
+        uint64_t dataBytes;
+    };
+
+    bool wav;
+    bool stems;
+    unsigned sampleRate;
+    DumpFile files[5];      // the mix, then the stems
+    std::atomic<bool> failed;
+
+    std::unique_ptr<SpscQueue<DumpSample, RingSamples>> ring;
+
+    std::mutex mutex;
+    std::condition_variable wakeup;     // samples were pushed, or quit
+    std::condition_variable drained;    // samples were popped
+    bool samplesReady;
+    bool quit;
+    bool finished;
+    std::thread thread;
+
+    void run();
+    void writeBatch(const DumpSample* samples, unsigned count);
+    void writeData(DumpFile& file, const void* data, size_t size);
+    void writeWavHeader(DumpFile& file);
+
+public:
+    AudioDumper(const std::string& path, unsigned sampleRate, bool stems);
+    ~AudioDumper();
+
+    bool hasStems() { return stems; }
+    // Queues count samples of the mix, and of each channel if dumping stems
+    void write(const StereoSample* mix, const int16_t* const* channels, unsigned count);
+    // Writes out everything queued and closes the files, returns false if any write failed
+    bool finish();
+};
@@ -0,0 +1,80 @@
+#include "AudioMixer.hpp"
+#include "Utils.hpp"
+
+#include <cstring>
+
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+void AudioMixer::mixScalar(const int16_t* const* channels, const int32_t* leftGains,
+        const int32_t* rightGains, unsigned count, StereoSample* out) {
+    for (unsigned i = 0; i < count; i++) {
+        int32_t left = 1 << (GainBits - 1), right = 1 << (GainBits - 1);
+        for (unsigned c = 0; c < Channels; c++) {
+            left += channels[c][i] * leftGains[c];
+            right += channels[c][i] * rightGains[c];
+        }
+        out[i].left = (int16_t)clamp(left >> GainBits, -32768, 32767);
+        out[i].right = (int16_t)clamp(right >> GainBits, -32768, 32767);
+    }
+}
+
+template<unsigned N>
+struct MixVec {
+    typedef int16_t H __attribute__((vector_size(2 * N)));
+    typedef int32_t S __attribute__((vector_size(4 * N)));
+    typedef uint32_t U __attribute__((vector_size(4 * N)));
+
+    static inline __attribute__((always_inline)) void clampSample(S& v) {
+        S low = S{} - 32768, high = S{} + 32767;
+        v = v < low ? low : v;
+        v = v > high ? high : v;
+    }
+};
+
+template<unsigned N>
+static inline __attribute__((always_inline)) void mixVec(const int16_t* const* channels, const int32_t* leftGains,
+        const int32_t* rightGains, unsigned count, StereoSample* out) {
+    typedef MixVec<N> V;
+    typedef typename V::H H;
+    typedef typename V::S S;
+    typedef typename V::U U;
+
+    unsigned i = 0;
+    for (; i + N <= count; i += N) {
+        S left = S{} + (1 << (AudioMixer::GainBits - 1)), right = left;
+        for (unsigned c = 0; c < AudioMixer::Channels; c++) {
+            H h;
+            std::memcpy(&h, channels[c] + i, sizeof(h));
+            S s = __builtin_convertvector(h, S);
+            left += s * leftGains[c];
+            right += s * rightGains[c];
+        }
+        left >>= (int)AudioMixer::GainBits;
+        right >>= (int)AudioMixer::GainBits;
+        V::clampSample(left);
+        V::clampSample(right);
+
+        // Left in the low half, right in the high half of each StereoSample
+        U packed = ((U)left & 0xffff) | ((U)right << 16);
+        std::memcpy(out + i, &packed, sizeof(packed));
+    }
+
+    const int16_t* rest[AudioMixer::Channels];
+    for (unsigned c = 0; c < AudioMixer::Channels; c++) {
+        rest[c] = channels[c] + i;
+    }
+    AudioMixer::mixScalar(rest, leftGains, rightGains, count - i, out + i);
+}
+
+static void mix4(const int16_t* const* channels, const int32_t* leftGains, const int32_t* rightGains,
+        unsigned count, StereoSample* out) {
+    mixVec<4>(channels, leftGains, rightGains, count, out);
+}
+
+X86_TARGET("avx2")
+static void mixAvx2(const int16_t* const* channels, const int32_t* leftGains, const int32_t* rightGains,
+        unsigned count, StereoSample* out) {
+    mixVec<8>(channels, leftGains, rightGains, count, out);
+}
+
+AudioMixer::MixFn AudioMixer::mix = selectForCpu<MixFn>(CpuFeature_Avx2, mixAvx2, mix4);
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "Platform.hpp"
+#include "Sound.hpp"
+
+// Mixes blocks of the four APU channels into stereo, with a gain per channel and side,
+// as a SIMD kernel (see Platform.hpp).
+struct AudioMixer {
+    enum {
+        Channels = 4,
+        GainBits = 12,      // gains are fixed point, 1 << GainBits leaves a channel as is
+    };
+
+    // Sums count samples of each channel times its left and right gains into out, clamped
+    typedef void (*MixFn)(const int16_t* const* channels, const int32_t* leftGains,
+            const int32_t* rightGains, unsigned count, StereoSample* out);
+
+    static MixFn mix;
+    static void mixScalar(const int16_t* const* channels, const int32_t* leftGains,
+            const int32_t* rightGains, unsigned count, StereoSample* out);
+};
@@ -0,0 +1,131 @@
+#include "BlipBuffer.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Band-limited impulse for each sub-sample phase: a Blackman-windowed sinc cut off a bit
+// below Nyquist, normalized so that each phase adds up to exactly 1 << DeltaBits
+static int16_t blipKernel[BlipBuffer::Phases][BlipBuffer::Taps];
+
+static struct InitBlipKernel {
+    InitBlipKernel() {
+        static const double Cutoff = 0.9;
+
+        for (unsigned phase = 0; phase < BlipBuffer::Phases; phase++) {
+            double impulse[BlipBuffer::Taps];
+            double sum = 0;
+            for (unsigned i = 0; i < BlipBuffer::Taps; i++) {
+                double t = i + 1.0 - BlipBuffer::HalfWidth - (double)phase / BlipBuffer::Phases;
+                double x = M_PI * Cutoff * t;
+                double sinc = t == 0 ? 1 : std::sin(x) / x;
+                double w = (t + BlipBuffer::HalfWidth) / (2 * BlipBuffer::HalfWidth);
+                double window = 0.42 - 0.5 * std::cos(2 * M_PI * w) + 0.08 * std::cos(4 * M_PI * w);
+                impulse[i] = sinc * window;
+                sum += impulse[i];
+            }
+
+            int total = 0;
+            unsigned largest = 0;
+            for (unsigned i = 0; i < BlipBuffer::Taps; i++) {
+                blipKernel[phase][i] = (int16_t)std::lround(impulse[i] / sum * (1 << BlipBuffer::DeltaBits));
+                total += blipKernel[phase][i];
+                if (blipKernel[phase][i] > blipKernel[phase][largest]) {
+                    largest = i;
+                }
+            }
+            // Rounding errors would otherwise leave a small DC step behind every delta
+            blipKernel[phase][largest] += (1 << BlipBuffer::DeltaBits) - total;
+        }
+    }
+} _initBlipKernel;
+
+BlipBuffer::BlipBuffer(unsigned long clockRate, unsigned sampleRate, unsigned capacity) :
+        factor(((uint64_t)sampleRate << TimeBits) / clockRate),
+        offset(0),
+        capacity(capacity),
+        available(0),
+        used(Taps),
+        integrator(0),
+        buffer(capacity + Taps) {
+}
+
+void BlipBuffer::setRates(double clockRate, double sampleRate) {
+    factor = (uint64_t)std::llround(sampleRate / clockRate * ((uint64_t)1 << TimeBits));
+}
+
+void BlipBuffer::addDelta(unsigned long clockTime, int delta) {
+    uint64_t time = clockTime * factor + offset;
+    unsigned pos = available + (unsigned)(time >> TimeBits);
+    unsigned phase = (unsigned)(time >> (TimeBits - PhaseBits)) & (Phases - 1);
+    if (pos + Taps > buffer.size()) {
+        // Too far ahead of the last readable sample, the frame should have ended long ago
+        return;
+    }
+
+    int32_t* out = &buffer[pos];
+    const int16_t* kernel = blipKernel[phase];
+    for (unsigned i = 0; i < Taps; i++) {
+        out[i] += kernel[i] * delta;
+    }
+    used = std::max(used, pos + Taps);
+}
+
+unsigned BlipBuffer::endFrame(unsigned long clockDuration) {
+    uint64_t time = clockDuration * factor + offset;
+    unsigned samples = (unsigned)(time >> TimeBits);
+    offset = time & (((uint64_t)1 << TimeBits) - 1);
+
+    unsigned dropped = 0;
+    if (available + samples > capacity) {
+        unsigned excess = available + samples - capacity;
+        int16_t scratch[64];
+        while (excess) {
+            unsigned n = std::min(excess, (unsigned)arraySize(scratch));
+            n = readSamples(scratch, n, 1);
+            if (!n) {
+                // Even the new frame alone doesn't fit
+                samples = capacity - available;
+                break;
+            }
+            excess -= n;
+            dropped += n;
+        }
+    }
+    available += samples;
+    return dropped;
+}
+
+unsigned BlipBuffer::readSamples(int16_t* out, unsigned count, unsigned stride) {
+    count = std::min(count, available);
+
+    int sum = integrator;
+    for (unsigned i = 0; i < count; i++) {
+        int sample = clamp(sum >> DeltaBits, -32768, 32767);
+        sum += buffer[i];
+        out[i * stride] = (int16_t)sample;
+        // High-pass: slowly pulls the output back towards zero
+        sum -= sample << (DeltaBits - BassShift);
+    }
+    integrator = sum;
+
+    removeSamples(count);
+    return count;
+}
+
+void BlipBuffer::removeSamples(unsigned count) {
+    // Deltas of the frame in progress, past the available samples, move along too
+    used = std::max(used, available + Taps);
+    std::copy(buffer.begin() + count, buffer.begin() + used, buffer.begin());
+    std::fill(buffer.begin() + used - count, buffer.begin() + used, 0);
+    available -= count;
+    used -= count;
+}
+
+void BlipBuffer::clear() {
+    offset = 0;
+    available = 0;
+    used = Taps;
+    integrator = 0;
+    std::fill(buffer.begin(), buffer.end(), 0);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Platform.hpp"
+
+#include <vector>
+
+// Band-limited step synthesis, after blip_buf. Sound sources add amplitude deltas at
+// exact clock times; each delta is spread over a few samples by a windowed-sinc kernel
+// picked by its sub-sample phase, and reading integrates the deltas back into samples.
+// This gives alias-free square waves without running the sources at the output rate.
+class BlipBuffer {
+public:
+    enum {
+        PhaseBits = 5,
+        Phases = 1 << PhaseBits,
+        HalfWidth = 8,
+        Taps = HalfWidth * 2,
+        DeltaBits = 15,     // kernel taps of a phase add up to 1 << DeltaBits
+        BassShift = 9,      // high-pass filter strength, removes DC offset
+        TimeBits = 32,      // fraction bits of sample positions
+    };
+
+    BlipBuffer(unsigned long clockRate, unsigned sampleRate, unsigned capacity);
+
+    // Changes the output rate; only call between frames
+    void setRates(double clockRate, double sampleRate);
+
+    // Adds an amplitude change at clockTime clocks after the start of the current frame
+    void addDelta(unsigned long clockTime, int delta);
+    // Ends the current frame clockDuration clocks after its start, making its samples readable.
+    // If the buffer is full, the oldest samples are dropped, and their count returned.
+    unsigned endFrame(unsigned long clockDuration);
+    unsigned samplesAvailable() { return available; }
+    // Index, counted from the next sample read, of the sample a delta added at clockTime is centered on
+    unsigned getSampleIndex(unsigned long clockTime) {
+        return available + (unsigned)((clockTime * factor + offset) >> TimeBits) + HalfWidth - 1;
+    }
+    // Reads up to count samples into every stride'th element of out, returns the count read
+    unsigned readSamples(int16_t* out, unsigned count, unsigned stride);
+    void clear();
+
+private:
+    uint64_t factor;        // samples per clock, TimeBits fixed point
+    uint64_t offset;        // position of the frame start past the last available sample
+    unsigned capacity;
+    unsigned available;
+    unsigned used;          // end of the buffer area touched by deltas so far
+    int integrator;
+    std::vector<int32_t> buffer;
+
+    void removeSamples(unsigned count);
+};
@@ -169,8 +169,7 @@ void Bus::tickDma(int cycles) {
     int nextCycles = std::min(dmaCycles + cycles, maxCycles);
 
     for (int i = dmaCycles / 4; i < nextCycles / 4; i++) {
-        Byte data = 0;
-        memAccess((dmaSourcePage << 8) | i, &data, false, "DMA");
+        Byte data = memRead8((dmaSourcePage << 8) | i, "DMA");
         gpu->oamAccess(i, &data, true);
     }
 
@@ -194,14 +193,17 @@ void Bus::disableBootrom() {
     bootromEnabled = false;
 }
 
+// The model is a template parameter so that DMG-only code doesn't pay for the
+// CGB checks on every memory access.
+template<GbModel Model>
 void Bus::memAccess(Word address, Byte* pData, bool isWrite, MemAccessType accessType) {
     if (address <= 0xff && bootromEnabled) {
         if (isWrite) {
             log->warn("Write to BootRom");
         } else {
-            BusUtil::arrayMemAccess(const_cast<Byte*>(isGbcMode() ? gbcBootrom1 : dmgBootrom), address, pData, false);
+            BusUtil::arrayMemAccess(const_cast<Byte*>(Model == Model_Cgb ? gbcBootrom1 : dmgBootrom), address, pData, false);
         }
-    } else if (isGbcMode() && bootromEnabled && address >= 0x0200 && address <= 0x08ff) {
+    } else if (Model == Model_Cgb && bootromEnabled && address >= 0x0200 && address <= 0x08ff) {
         if (isWrite) {
             log->warn("Write to BootRom");
         } else {
@@ -210,7 +212,7 @@ void Bus::memAccess(Word address, Byte* pData, bool isWrite, MemAccessType acces
     } else if (address <= 0x7fff) {
         rom->cartRomAccess(address, pData, isWrite);
     } else if (address <= 0x9fff) {
-        gpu->vramAccess(address & 0x1fff, pData, isWrite);
+        gpu->vramAccess<Model>(address & 0x1fff, pData, isWrite);
     } else if (address <= 0xbfff) {
         rom->cartRamAccess(address & 0x1fff, pData, isWrite);
     } else if (address <= 0xfdff) {
@@ -222,7 +224,7 @@ void Bus::memAccess(Word address, Byte* pData, bool isWrite, MemAccessType acces
         } else {
             // D000-DFFF, mirrored F000-FDFF: GBC bank-switchable RAM
             unsigned bank = wramBank;
-            if (!isGbcMode() || !bank) {
+            if (Model == Model_Dmg || !bank) {
                 bank = 1;
             }
             BusUtil::arrayMemAccess(&ram[bank * 4096], offset, pData, isWrite);
@@ -245,7 +247,7 @@ void Bus::memAccess(Word address, Byte* pData, bool isWrite, MemAccessType acces
         gpu->registerAccess(address, pData, isWrite);
     } else if (address == 0xff50) {
         disableBootrom();
-    } else if (isGbcMode() && address == 0xff70) {
+    } else if (Model == Model_Cgb && address == 0xff70) {
         BusUtil::simpleRegAccess(&wramBank, pData, isWrite, 0x07);
     } else if (address >= 0xff80 && address <= 0xfffe) {
         BusUtil::arrayMemAccess(hram, address - 0xff80, pData, isWrite);
@@ -267,13 +269,15 @@ void Bus::memAccess(Word address, Byte* pData, bool isWrite, MemAccessType acces
 }
 
 Byte Bus::memRead8(Word address, MemAccessType accessType) {
-    Byte value = 0;
-    memAccess(address, &value, false, accessType);
-    return value;
+    return isGbc ? memRead8<Model_Cgb>(address, accessType) : memRead8<Model_Dmg>(address, accessType);
 }
 
 void Bus::memWrite8(Word address, Byte value, MemAccessType accessType) {
-    memAccess(address, &value, true, accessType);
+    if (isGbc) {
+        memWrite8<Model_Cgb>(address, value, accessType);
+    } else {
+        memWrite8<Model_Dmg>(address, value, accessType);
+    }
 }
 
 Word Bus::memRead16(Word address, MemAccessType accessType) {
@@ -312,6 +316,9 @@ bool Bus::isGbcMode() {
     return isGbc;
 }
 
+template void Bus::memAccess<Model_Dmg>(Word address, Byte* pData, bool isWrite, MemAccessType accessType);
+template void Bus::memAccess<Model_Cgb>(Word address, Byte* pData, bool isWrite, MemAccessType accessType);
+
 void Bus::serialize(Serializer& ser) {
     ser.handleObject("Bus.isGbc", isGbc);
     ser.handleObject("Bus.bootromEnabled", bootromEnabled);
@@ -19,6 +19,11 @@ class Sound;
 
 class Timer;
 
+enum GbModel {
+    Model_Dmg,
+    Model_Cgb,
+};
+
 class Bus {
     Logger* log;
     Rom* rom;
@@ -29,6 +34,7 @@ class Bus {
     Sound* sound;
 
     bool isGbc;
+
     bool bootromEnabled;
     bool dmaInProgress;
     int dmaCycles;
@@ -43,6 +49,7 @@ class Bus {
     Byte hram[127];
 
     void dmaRegAccess(Byte* pData, bool isWrite);
+    template<GbModel Model>
     void memAccess(Word address, Byte* pData, bool isWrite, MemAccessType accessType);
     void disableBootrom();
 
@@ -70,6 +77,28 @@ public:
     void serialize(Serializer& ser);
     void tickDma(int cycles);
 
+    // For the CPU, which resolves the model once per frame. The versions without a model
+    // check it on every access.
+    template<GbModel Model>
+    Byte memRead8(Word address, MemAccessType accessType = "CPU") {
+        Byte value = 0;
+        memAccess<Model>(address, &value, false, accessType);
+        return value;
+    }
+    template<GbModel Model>
+    void memWrite8(Word address, Byte value, MemAccessType accessType = "CPU") {
+        memAccess<Model>(address, &value, true, accessType);
+    }
+    template<GbModel Model>
+    Word memRead16(Word address, MemAccessType accessType = "CPU") {
+        return memRead8<Model>(address, accessType) | (memRead8<Model>(address + 1, accessType) << 8);
+    }
+    template<GbModel Model>
+    void memWrite16(Word address, Word value, MemAccessType accessType = "CPU") {
+        memWrite8<Model>(address, (Byte)(value), accessType);
+        memWrite8<Model>(address + 1, (Byte)(value >> 8), accessType);
+    }
+
     Byte memRead8(Word address, MemAccessType accessType = "CPU");
     void memWrite8(Word address, Byte value, MemAccessType accessType = "CPU");
     Word memRead16(Word address, MemAccessType accessType = "CPU");
@@ -33,13 +33,13 @@ static const char* const reg16AutodecStrings[] = {
 
 // 'x' is an instruction encoding for one of the following: B C D E H L (HL) A
 // The '^ 1' does the endian swap for little-endian host
-#define LOAD8(x) ((x) == 6 ? bus->memRead8(regs.hl) : (x) == 7 ? regs.a : regs.bytes[(x) ^ 1])
-#define STORE8(x, v) ((x) == 6 ? bus->memWrite8(regs.hl, v) : (void)(((x) == 7 ? regs.a : regs.bytes[(x) ^ 1]) = (v)))
+#define LOAD8(x) ((x) == 6 ? bus->memRead8<Model>(regs.hl) : (x) == 7 ? regs.a : regs.bytes[(x) ^ 1])
+#define STORE8(x, v) ((x) == 6 ? bus->memWrite8<Model>(regs.hl, v) : (void)(((x) == 7 ? regs.a : regs.bytes[(x) ^ 1]) = (v)))
 
 #define ldst8ExtraCycles(x) ((x) == 6 ? 4 : 0)
 
-#define LOAD8_AUTODEC(x) (bus->memRead8((x) == 2 ? regs.hl++ : (x) == 3 ? regs.hl-- : regs.words[x]))
-#define STORE8_AUTODEC(x, v) (bus->memWrite8((x) == 2 ? regs.hl++ : (x) == 3 ? regs.hl-- : regs.words[x], (v)))
+#define LOAD8_AUTODEC(x) (bus->memRead8<Model>((x) == 2 ? regs.hl++ : (x) == 3 ? regs.hl-- : regs.words[x]))
+#define STORE8_AUTODEC(x, v) (bus->memWrite8<Model>((x) == 2 ? regs.hl++ : (x) == 3 ? regs.hl-- : regs.words[x], (v)))
 
 void Cpu::reset() {
     regs = Regs();
@@ -47,6 +47,9 @@ void Cpu::reset() {
     stopped = false;
 }
 
+// The model is resolved by the caller, so that memory accesses are direct calls to
+// the matching Bus::memAccess specialization.
+template<GbModel Model>
 long Cpu::tick() {
     Byte irqs = bus->getPendingIrqs();
     if (irqs) {
@@ -59,7 +62,7 @@ long Cpu::tick() {
         log->logDebug("Handling IRQ %d", irq);
 
         regs.sp -= 2;
-        bus->memWrite16(regs.sp, regs.pc);
+        bus->memWrite16<Model>(regs.sp, regs.pc);
         regs.pc = 0x40 + irq * 0x8;
         regs.irqsEnabled = false;
         return 12; // TODO: what's the delay?
@@ -69,16 +72,16 @@ long Cpu::tick() {
         return 4;
     }
 
-    Byte opc = bus->memRead8(regs.pc++);
+    Byte opc = bus->memRead8<Model>(regs.pc++);
     switch (opc >> 6) {
         case 0:
-            return executeInsn_0x_3x(opc);
+            return executeInsn_0x_3x<Model>(opc);
         case 1:
-            return executeInsn_4x_6x(opc);
+            return executeInsn_4x_6x<Model>(opc);
         case 2:
-            return executeInsn_7x_Bx(opc);
+            return executeInsn_7x_Bx<Model>(opc);
         case 3:
-            return executeInsn_Cx_Fx(opc);
+            return executeInsn_Cx_Fx<Model>(opc);
     }
     unreachable();
 }
@@ -208,6 +211,7 @@ Byte Cpu::doAluOp(int aluop, Byte lhs, Byte rhs) {
     unreachable();
 }
 
+template<GbModel Model>
 long Cpu::executeInsn_0x_3x(Byte opc) {
     INSN_DBG_DECL();
 
@@ -221,9 +225,9 @@ long Cpu::executeInsn_0x_3x(Byte opc) {
             return INSN_DONE(4, "STOP");
         }
         case 0x08: {
-            Word addr = bus->memRead16(regs.pc);
+            Word addr = bus->memRead16<Model>(regs.pc);
             regs.pc += 2;
-            bus->memWrite16(addr, regs.sp);
+            bus->memWrite16<Model>(addr, regs.sp);
             return INSN_DONE(20, "LD (0x%04x), SP", addr);
         }
         case 0x07: {
@@ -283,7 +287,7 @@ long Cpu::executeInsn_0x_3x(Byte opc) {
         case 0x8: {
             char buf[16];
 
-            int delta = (SByte)bus->memRead8(regs.pc++);
+            int delta = (SByte)bus->memRead8<Model>(regs.pc++);
             bool taken = evalConditional(opc, buf, "JR");
             if (taken)
                 INSN_BRANCH(regs.pc + delta);
@@ -291,7 +295,7 @@ long Cpu::executeInsn_0x_3x(Byte opc) {
             return INSN_DONE(taken ? 12 : 8, "%s 0x%04x", buf, regs.pc);
         }
         case 0x1: {
-            Word val = bus->memRead16(regs.pc);
+            Word val = bus->memRead16<Model>(regs.pc);
             regs.pc += 2;
             regs.words[operand] = val;
             return INSN_DONE(12, "LD %s, 0x%04x", reg16SpStrings[operand], val);
@@ -332,7 +336,7 @@ long Cpu::executeInsn_0x_3x(Byte opc) {
         }
         case 0x6:
         case 0xE: {
-            Byte val = bus->memRead8(regs.pc++);
+            Byte val = bus->memRead8<Model>(regs.pc++);
             STORE8(byteOperand, val);
             return INSN_DONE(4 + ldst8ExtraCycles(byteOperand), "LD %s, 0x%02x",
                     reg8Strings[byteOperand], val);
@@ -343,6 +347,7 @@ long Cpu::executeInsn_0x_3x(Byte opc) {
 
 // Opcodes 4x..6x: Moves between 8-bit regs / (HL)
 // Bottom 3 bits = source, next 3 bits destination. Order is: B C D E H L (HL) A
+template<GbModel Model>
 long Cpu::executeInsn_4x_6x(Byte opc) {
     INSN_DBG_DECL();
 
@@ -363,6 +368,7 @@ long Cpu::executeInsn_4x_6x(Byte opc) {
 
 // Opcodes 7x..Bx: Accu-based 8-bit alu ops
 // Bottom 3 bits = reg/(HL) operand, next 3 bits ALU op. Order is ADD, ADC, SUB, SBC, AND, XOR, OR, CP
+template<GbModel Model>
 long Cpu::executeInsn_7x_Bx(Byte opc) {
     INSN_DBG_DECL();
 
@@ -374,30 +380,31 @@ long Cpu::executeInsn_7x_Bx(Byte opc) {
             "%s %s", aluopStrings[aluop], reg8Strings[operand]);
 }
 
+template<GbModel Model>
 long Cpu::executeInsn_Cx_Fx(Byte opc) {
     INSN_DBG_DECL();
 
     switch (opc) {
         case 0xE0: {
-            Word address = 0xff00 | bus->memRead8(regs.pc++);
-            bus->memWrite8(address, regs.a);
+            Word address = 0xff00 | bus->memRead8<Model>(regs.pc++);
+            bus->memWrite8<Model>(address, regs.a);
             return INSN_DONE(12, "LDH (0x%04x), A", address);
         }
         case 0xF0: {
-            Word address = 0xff00 | bus->memRead8(regs.pc++);
-            regs.a = bus->memRead8(address);
+            Word address = 0xff00 | bus->memRead8<Model>(regs.pc++);
+            regs.a = bus->memRead8<Model>(address);
             return INSN_DONE(12, "LDH A, (0x%04x)", address);
         }
         case 0xE8: {
             // TODO: nowhere is really documented how the flags are set in this case.
-            SByte tmp = (SByte)bus->memRead8(regs.pc++);
+            SByte tmp = (SByte)bus->memRead8<Model>(regs.pc++);
             regs.sp = doAdd16(regs.sp, (Word)tmp);
             regs.flags.z = 0;
             return INSN_DONE(16, "ADD SP, %d", tmp);
         }
         case 0xF8: {
             // TODO: not sure about these flags either
-            SByte tmp = (SByte)bus->memRead8(regs.pc++);
+            SByte tmp = (SByte)bus->memRead8<Model>(regs.pc++);
             regs.hl = doAdd16(regs.sp, (Word)tmp);
             regs.flags.z = 0;
             return INSN_DONE(12, "LD HL, SP + %d", tmp);
@@ -411,22 +418,22 @@ long Cpu::executeInsn_Cx_Fx(Byte opc) {
             return INSN_DONE(8, "LD SP, HL");
         }
         case 0xE2: {
-            bus->memWrite8(0xff00 | regs.c, regs.a);
+            bus->memWrite8<Model>(0xff00 | regs.c, regs.a);
             return INSN_DONE(8, "LDH (C), A");
         }
         case 0xF2: {
-            regs.a = bus->memRead8(0xff00 | regs.c);
+            regs.a = bus->memRead8<Model>(0xff00 | regs.c);
             return INSN_DONE(8, "LDH A, (C)");
         }
         case 0xEA: {
-            Word address = bus->memRead16(regs.pc);
-            bus->memWrite8(address, regs.a);
+            Word address = bus->memRead16<Model>(regs.pc);
+            bus->memWrite8<Model>(address, regs.a);
             regs.pc += 2;
             return INSN_DONE(16, "LD (0x%04x), A", address);
         }
         case 0xFA: {
-            Word address = bus->memRead16(regs.pc);
-            regs.a = bus->memRead8(address);
+            Word address = bus->memRead16<Model>(regs.pc);
+            regs.a = bus->memRead8<Model>(address);
             regs.pc += 2;
             return INSN_DONE(16, "LD A, (0x%04x)", address);
         }
@@ -435,7 +442,7 @@ long Cpu::executeInsn_Cx_Fx(Byte opc) {
             return INSN_DONE(4, "DI");
         }
         case 0xCB: {
-            return executeTwoByteInsn();
+            return executeTwoByteInsn<Model>();
         }
         case 0xFB: {
             regs.irqsEnabled = true;
@@ -466,7 +473,7 @@ long Cpu::executeInsn_Cx_Fx(Byte opc) {
             bool unconditional = opc & 1;
             bool taken = evalConditional(opc, buf, "RET");
             if (taken) {
-                INSN_BRANCH(bus->memRead16(regs.sp));
+                INSN_BRANCH(bus->memRead16<Model>(regs.sp));
                 regs.sp += 2;
             }
             if (opc == 0xd9) {
@@ -476,7 +483,7 @@ long Cpu::executeInsn_Cx_Fx(Byte opc) {
             return INSN_DONE(unconditional ? 16 : taken ? 20 : 8, "%s", buf);
         }
         case 0x1: {
-            Word value = bus->memRead16(regs.sp);
+            Word value = bus->memRead16<Model>(regs.sp);
             regs.sp += 2;
             if (operand == 3) {
                 regs.af = value;
@@ -489,7 +496,7 @@ long Cpu::executeInsn_Cx_Fx(Byte opc) {
         case 0x3:
         case 0x2:
         case 0xA: {
-            Word addr = bus->memRead16(regs.pc);
+            Word addr = bus->memRead16<Model>(regs.pc);
             regs.pc += 2;
 
             char buf[16];
@@ -501,33 +508,33 @@ long Cpu::executeInsn_Cx_Fx(Byte opc) {
         case 0xD:
         case 0x4:
         case 0xC: {
-            Word addr = bus->memRead16(regs.pc);
+            Word addr = bus->memRead16<Model>(regs.pc);
             regs.pc += 2;
 
             char buf[16];
             bool taken = evalConditional(opc, buf, "CALL");
             if (taken) {
                 regs.sp -= 2;
-                bus->memWrite16(regs.sp, regs.pc);
+                bus->memWrite16<Model>(regs.sp, regs.pc);
                 INSN_BRANCH(addr);
             }
             return INSN_DONE(taken ? 24 : 12, "%s 0x%04x", buf, addr);
         }
         case 0x5: {
             regs.sp -= 2;
-            bus->memWrite16(regs.sp, operand == 3 ? regs.af : regs.words[operand]);
+            bus->memWrite16<Model>(regs.sp, operand == 3 ? regs.af : regs.words[operand]);
             return INSN_DONE(16, "PUSH %s", reg16AfStrings[operand]);
         }
         case 0x6:
         case 0xE: {
-            Byte value = bus->memRead8(regs.pc++);
+            Byte value = bus->memRead8<Model>(regs.pc++);
             regs.a = doAluOp(wideOperand, regs.a, value);
             return INSN_DONE(8, "%s 0x%02x", aluopStrings[wideOperand], value);
         }
         case 0x7:
         case 0xF: {
             regs.sp -= 2;
-            bus->memWrite16(regs.sp, regs.pc);
+            bus->memWrite16<Model>(regs.sp, regs.pc);
             INSN_BRANCH(wideOperand * 0x08);
             return INSN_DONE(16, "RST 0x%02x", regs.pc);
         }
@@ -535,9 +542,10 @@ long Cpu::executeInsn_Cx_Fx(Byte opc) {
     unreachable();
 }
 
+template<GbModel Model>
 long Cpu::executeTwoByteInsn() {
     INSN_DBG_DECL();
-    Byte opc = bus->memRead8(regs.pc++);
+    Byte opc = bus->memRead8<Model>(regs.pc++);
     const char* description __attribute__((unused));
 
     int operand = opc & 0x7;
@@ -613,6 +621,9 @@ long Cpu::executeTwoByteInsn() {
     }
 }
 
+template long Cpu::tick<Model_Dmg>();
+template long Cpu::tick<Model_Cgb>();
+
 void Cpu::serialize(Serializer& ser) {
     ser.handleObject("Cpu.regs", regs);
     ser.handleObject("Cpu.halted", halted);
@@ -50,10 +50,15 @@ class Cpu {
     Byte doRotRightWithCarry(Byte v);
     Byte doAluOp(int aluop, Byte lhs, Byte rhs);
 
+    template<GbModel Model>
     long executeInsn_0x_3x(Byte opc);
+    template<GbModel Model>
     long executeInsn_4x_6x(Byte opc);
+    template<GbModel Model>
     long executeInsn_7x_Bx(Byte opc);
+    template<GbModel Model>
     long executeInsn_Cx_Fx(Byte opc);
+    template<GbModel Model>
     long executeTwoByteInsn();
 
 public:
@@ -67,6 +72,7 @@ public:
     Regs* getRegs() { return &regs; }
 
     void reset();
+    template<GbModel Model>
     long tick();
     void serialize(Serializer& ser);
 };
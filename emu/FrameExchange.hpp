@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Platform.hpp"
+
+#include <atomic>
+#include <bitset>
+#include <cstddef>
+#include <cstring>
+
+// Triple buffer for handing complete frames from the emulation thread to one consumer
+// thread. Neither side ever blocks or waits for the other: the producer always has a
+// buffer to fill, and the consumer always gets the latest frame that was published.
+template<std::size_t FrameSize, std::size_t Lines>
+class FrameExchange {
+    enum {
+        IndexMask = 0x3,
+        FreshBit = 0x4,     // the middle buffer holds a frame the consumer hasn't seen
+        DirtyWords = (Lines + 63) / 64,
+    };
+
+    Byte buffers[3][FrameSize];
+    std::atomic<unsigned> middle;   // index of the buffer between producer and consumer, plus FreshBit
+    unsigned back;                  // only used by the producer
+    unsigned front;                 // only used by the consumer
+
+    // Lines changed in published frames that the consumer hasn't taken yet
+    std::atomic<uint64_t> dirtyLines[DirtyWords];
+
+public:
+    FrameExchange() :
+            middle(1),
+            back(0),
+            front(2) {
+        std::memset(buffers, 0, sizeof(buffers));
+        for (unsigned i = 0; i < DirtyWords; i++) {
+            dirtyLines[i] = ~0ULL;
+        }
+    }
+
+    // Only the first size bytes are copied, for producers whose frames can be smaller
+    void publish(const Byte* frame, const std::bitset<Lines>& changedLines, std::size_t size = FrameSize) {
+        std::memcpy(buffers[back], frame, size);
+        back = middle.exchange(back | FreshBit, std::memory_order_acq_rel) & IndexMask;
+
+        // Marked after publishing: a consumer that misses these bits now will re-upload the
+        // lines from a newer frame next time, instead of never uploading them at all
+        uint64_t words[DirtyWords] = {};
+        for (unsigned i = 0; i < Lines; i++) {
+            words[i / 64] |= (uint64_t)changedLines[i] << (i % 64);
+        }
+        for (unsigned i = 0; i < DirtyWords; i++) {
+            if (words[i]) {
+                dirtyLines[i].fetch_or(words[i], std::memory_order_release);
+            }
+        }
+    }
+
+    // Returns the latest published frame, and adds the lines that changed since the
+    // previous call to changedLines
+    const Byte* acquire(std::bitset<Lines>& changedLines) {
+        for (unsigned i = 0; i < DirtyWords; i++) {
+            uint64_t word = dirtyLines[i].exchange(0, std::memory_order_acquire);
+            for (unsigned bit = 0; word && i * 64 + bit < Lines; bit++, word >>= 1) {
+                if (word & 1) {
+                    changedLines.set(i * 64 + bit);
+                }
+            }
+        }
+
+        if (middle.load(std::memory_order_relaxed) & FreshBit) {
+            front = middle.exchange(front, std::memory_order_acq_rel) & IndexMask;
+        }
+        return buffers[front];
+    }
+};
@@ -0,0 +1,42 @@
+#include "FrameSkipper.hpp"
+
+#include <algorithm>
+
+void FrameSkipper::setMode(FrameSkipMode mode, unsigned skipCount) {
+    this->mode = mode;
+    this->skipCount = mode == FrameSkip_Adaptive && skipCount == 0 ? (unsigned)MaxAdaptiveSkips : skipCount;
+    consecutiveSkips = 0;
+    lagNsecs = 0;
+}
+
+// Called at the start of each frame
+bool FrameSkipper::shouldRenderFrame() {
+    bool skip;
+    switch (mode) {
+        case FrameSkip_Fixed:
+            skip = consecutiveSkips < skipCount;
+            break;
+        case FrameSkip_Adaptive:
+            // Never skip so many frames in a row that the picture appears frozen
+            skip = lagNsecs > 0 && consecutiveSkips < skipCount;
+            break;
+        default:
+            skip = false;
+            break;
+    }
+
+    if (skip) {
+        consecutiveSkips++;
+        skippedFrames++;
+    } else {
+        consecutiveSkips = 0;
+    }
+    return !skip;
+}
+
+// Called by the frontend after each frame with the host time spent emulating and presenting it
+void FrameSkipper::reportHostFrameTime(long nsecs, long budgetNsecs) {
+    // Bounded, so that a single stall doesn't cause a long burst of skips, and
+    // time saved on idle frames doesn't hide a later slowdown
+    lagNsecs = std::max(-budgetNsecs, std::min(lagNsecs + nsecs - budgetNsecs, 2 * budgetNsecs));
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+enum FrameSkipMode {
+    FrameSkip_Off,
+    FrameSkip_Fixed,       // render one frame, then skip a fixed number of frames
+    FrameSkip_Adaptive,    // skip frames while the host is falling behind real time
+};
+
+// Decides which frames the Gpu renders. Skipped frames are still fully emulated,
+// only drawing the scanlines is left out.
+class FrameSkipper {
+    FrameSkipMode mode;
+    unsigned skipCount;         // frames skipped after each rendered frame, or the adaptive limit
+    unsigned consecutiveSkips;
+    long lagNsecs;              // how far the host is behind real time
+    long skippedFrames;
+
+public:
+    enum {
+        MaxAdaptiveSkips = 4,
+    };
+
+    FrameSkipper() :
+            mode(FrameSkip_Off),
+            skipCount(0),
+            consecutiveSkips(0),
+            lagNsecs(0),
+            skippedFrames(0) {
+    }
+
+    void setMode(FrameSkipMode mode, unsigned skipCount = 0);
+    FrameSkipMode getMode() { return mode; }
+    long getSkippedFrames() { return skippedFrames; }
+
+    bool shouldRenderFrame();
+    void reportHostFrameTime(long nsecs, long budgetNsecs);
+};
@@ -1,14 +1,28 @@
 #include "Gameboy.hpp"
 
-void Gameboy::runOneInstruction() {
-    long newFrame = gpu.getCurrentFrame();
-    log->setTimestamp(newFrame, gpu.getCurrentScanline(), currentCycle);
+#include <algorithm>
+
+// Input is polled once per scanline, and exactly at the cycle of the next timestamped
+// event queued. Events queued through Joypad directly, possibly from another thread,
+// only reach the core at the next poll.
+static const long InputPollCycles = ScanlineCycles;
 
-    if (joypad.tick()) {
+void Gameboy::pollInput() {
+    if (joypad.processEvents(currentCycle)) {
         bus.raiseIrq(bit(Irq_Joypad));
     }
 
-    int cycleDelta = cpu.tick();
+    long nextPoll = (currentCycle / InputPollCycles + 1) * InputPollCycles;
+    nextInputCycle = std::min(nextPoll, joypad.getNextEventCycle());
+}
+
+template<GbModel Model>
+inline void Gameboy::step() {
+    if (currentCycle >= nextInputCycle) {
+        pollInput();
+    }
+
+    int cycleDelta = cpu.tick<Model>();
 
     bus.tickDma(cycleDelta);
     if (timer.tick(cycleDelta)) {
@@ -20,11 +34,36 @@ void Gameboy::runOneInstruction() {
 
     IrqSet gpuIrqs = gpu.tick(cycleDelta);
     bus.raiseIrq(gpuIrqs);
-    sound.tick(cycleDelta);
     currentCycle += cycleDelta;
 }
 
+template<GbModel Model>
+void Gameboy::runUntilNextFrame() {
+    long frame = gpu.getCurrentFrame();
+    while (gpu.getCurrentFrame() == frame) {
+        step<Model>();
+    }
+}
+
+void Gameboy::runOneInstruction() {
+    if (bus.isGbcMode()) {
+        step<Model_Cgb>();
+    } else {
+        step<Model_Dmg>();
+    }
+}
+
+void Gameboy::runFrame() {
+    if (bus.isGbcMode()) {
+        runUntilNextFrame<Model_Cgb>();
+    } else {
+        runUntilNextFrame<Model_Dmg>();
+    }
+}
+
 void Gameboy::serialize(Serializer& ser) {
+    // Sound state is saved as of the current cycle
+    sound.catchUp();
     ser.handleObject("Gameboy.currentCycle", currentCycle);
     bus.serialize(ser);
     gpu.serialize(ser);
@@ -33,4 +72,6 @@ void Gameboy::serialize(Serializer& ser) {
     joypad.serialize(ser);
     serial.serialize(ser);
     sound.serialize(ser);
+
+    nextInputCycle = 0;
 }
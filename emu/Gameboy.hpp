@@ -20,6 +20,13 @@ class Gameboy {
     Serial serial;
     Sound sound;
     long currentCycle;
+    long nextInputCycle;
+
+    void pollInput();
+    template<GbModel Model>
+    void step();
+    template<GbModel Model>
+    void runUntilNextFrame();
 
 public:
     Gameboy(Logger* log, Rom* rom, bool gbc) :
@@ -30,8 +37,10 @@ public:
             timer(),
             joypad(),
             serial(),
-            sound(log),
-            currentCycle(0) {
+            sound(log, &currentCycle),
+            currentCycle(0),
+            nextInputCycle(0) {
+        log->setClockSource(this);
     }
 
 
@@ -40,8 +49,19 @@ public:
     Gpu* getGpu() { return &gpu; }
     Timer* getTimer() { return &timer; }
     Joypad* getJoypad() { return &joypad; }
+    // Queues a timestamped input event from the emulation thread, in cycle order. Unlike
+    // Joypad::queueEvent(), the event is applied exactly at its cycle even if it comes
+    // earlier than the next input poll.
+    bool queueInputEvent(const JoypadEvent& event) {
+        nextInputCycle = 0;
+        return joypad.queueEvent(event);
+    }
     Sound* getSound() { return &sound; }
+    long getCurrentCycle() { return currentCycle; }
 
     void serialize(Serializer& s);
     void runOneInstruction();
+    // Runs until the GPU starts a new frame. Quicker than runOneInstruction() in a loop,
+    // as the hardware model is only checked once.
+    void runFrame();
 };
@@ -1,5 +1,8 @@
 #include "Gpu.hpp"
+#include "GpuWorker.hpp"
+#include "PixelKernels.hpp"
 #include "Serializer.hpp"
+#include "Utils.hpp"
 #include <algorithm>
 
 /*
@@ -16,10 +19,55 @@
 enum {
     OamFetchThresholdCycles = 80,
     VramFetchThresholdCycles = 80 + 172,
+    FirstPixelCycles = 80 + 12,     // the first 12 dots of mode 3 are spent fetching
 
     MaxScanline = 153,
 };
 
+// Out of line, as the worker is only forward declared in the header
+Gpu::Gpu(Logger* log, Bus* bus) :
+        log(log),
+        bus(bus),
+        renderEnabled(true),
+        skipFrame(false),
+        lastFrameSkipped(false),
+        frame(0),
+        cycleResidue(0),
+        pixelFormat(PixelFormat_Xrgb8888),
+        colorCorrection(false),
+        spriteTableDirty(true),
+        hostColorsDirty(true),
+        frameHashing(false),
+        frameHash(0),
+        worker(),
+        accurateRendering(true),
+        fifoActive(false) {
+    std::memset(&framebuffer[0], 0, sizeof(framebuffer));
+    std::memset(&vram[0], 0, sizeof(vram));
+    std::memset(&oam[0], 0, sizeof(oam));
+    std::memset(&cgbBackgroundPalette[0], 0, sizeof(cgbBackgroundPalette));
+    std::memset(&cgbSpritePalette[0], 0, sizeof(cgbSpritePalette));
+    std::memset(&regs, 0, sizeof(regs));
+    std::memset(&visibleSprites[0], 0, sizeof(visibleSprites));
+    std::memset(&hashFrame[0], 0, sizeof(hashFrame));
+    std::memset(&generations, 0, sizeof(generations));
+    dirtyTiles.set();
+    dirtyLines.set();
+}
+
+Gpu::~Gpu() {
+}
+
+void Gpu::setThreadedRendering(bool threaded) {
+    if (threaded && !worker) {
+        worker.reset(new GpuWorker(log, bus));
+        worker->syncFrom(this);
+    } else if (!threaded && worker) {
+        worker->collectFrame(this);
+        worker.reset();
+    }
+}
+
 IrqSet Gpu::tick(long cycles) {
     IrqSet irqs = 0;
 
@@ -38,7 +86,21 @@ IrqSet Gpu::tick(long cycles) {
         if (regs.ly > MaxScanline) {
             regs.ly = 0;
             frame++;
+            lastFrameSkipped = skipFrame;
+            skipFrame = !frameSkipper.shouldRenderFrame();
         } else if (regs.ly == ScreenHeight) {
+            if (renderEnabled && !skipFrame) {
+                if (worker) {
+                    worker->collectFrame(this);
+                }
+                frameExchange.publish(framebuffer, dirtyLines);
+                dirtyLines.reset();
+            }
+            if (frameHashing) {
+                // Skipped frames aren't drawn, there is nothing to hash
+                frameHash = renderEnabled && !skipFrame ? hashBytes(hashFrame, sizeof(hashFrame)) : 0;
+            }
+
             irqs |= bit(Irq_VBlank);
             if (regs.vBlankIrqEnabled) {
                 irqs |= bit(Irq_LcdStat);
@@ -49,8 +111,13 @@ IrqSet Gpu::tick(long cycles) {
             irqs |= bit(Irq_LcdStat);
         }
     } else if (regs.ly < ScreenHeight) {
-        if (!nowInOamFetch && wasInOamFetch && renderEnabled) {
-            captureSpriteState();
+        bool drawing = renderEnabled && !skipFrame;
+        if (!nowInOamFetch && wasInOamFetch && drawing) {
+            if (worker) {
+                worker->recordLine(GpuCommand::CaptureSprites, regs);
+            } else {
+                captureSpriteState();
+            }
         }
         if (nowInOamFetch && !wasInHBlank) {
             if (regs.oamIrqEnabled) {
@@ -58,7 +125,15 @@ IrqSet Gpu::tick(long cycles) {
             }
         }
         if (nowInHBlank && !wasInHBlank) {
-            if (renderEnabled) {
+            if (drawing && worker) {
+                worker->recordLine(GpuCommand::RenderLine, regs);
+                // Handing over lines in groups keeps the thread wakeups down
+                if (regs.ly % 16 == 15) {
+                    worker->submit();
+                }
+            } else if (drawing && fifoActive) {
+                finishFifoLine();
+            } else if (drawing) {
                 renderScanline();
             }
 
@@ -73,144 +148,442 @@ IrqSet Gpu::tick(long cycles) {
     return regs.lcdEnabled ? irqs : 0;
 }
 
-Byte Gpu::drawTilePixel(Byte* tile, unsigned x, unsigned y, bool large, OamEntry::OamFlags flags) {
+void Gpu::decodeDirtyTiles() {
+    for (unsigned i = 0; i < 2 * TilesPerBank; i++) {
+        if (dirtyTiles[i]) {
+            Byte* tile = &vram[(i / TilesPerBank) * 8192 + (i % TilesPerBank) * 16];
+            PixelKernels::decodeTile(tile, &decodedTiles[i][0][0][0], &decodedTiles[i][1][0][0]);
+        }
+    }
+    dirtyTiles.reset();
+}
+
+template<GbModel Model>
+const Byte* Gpu::tileRow(unsigned tileIndex, unsigned y, bool large, OamEntry::OamFlags flags) {
     Byte height = large ? 16 : 8;
-    unsigned base = 2 * (flags.yFlip ? height - y - 1 : y);
+    unsigned row = flags.yFlip ? height - y - 1 : y;
 
-    if (bus->isGbcMode() && flags.cgbTileVramBank) {
-        // Slight hack...
-        tile += 8192;
+    // Rows 8-15 of large sprites continue in the next tile
+    tileIndex += row / 8;
+    if (Model == Model_Cgb && flags.cgbTileVramBank) {
+        tileIndex += TilesPerBank;
     }
 
-    Byte lsbs = flags.xFlip ? reverseBits(tile[base + 0]) : tile[base + 0];
-    Byte msbs = flags.xFlip ? reverseBits(tile[base + 1]) : tile[base + 1];
-
-    return (!!(lsbs & (0x80 >> x))) |
-            ((!!(msbs & (0x80 >> x))) << 1);
+    return decodedTiles[tileIndex][flags.xFlip][row % 8];
 }
 
-void Gpu::captureSpriteState() {
-    unsigned num = 0;
+void Gpu::rebuildSpriteTable() {
+    std::memset(lineSpriteCounts, 0, sizeof(lineSpriteCounts));
+
+    // The hardware picks the first 10 sprites in OAM order on each line...
     for (unsigned j = 0; j < 40; j++) {
         int spriteTop = sprites[j].y - 16;
         int spriteBottom = spriteTop + (regs.objSizeLarge ? 16 : 8);
 
-        if (!(regs.ly >= spriteTop && regs.ly < spriteBottom)) {
-            // not visible this scanline
-            continue;
+        for (int line = std::max(spriteTop, 0); line < std::min(spriteBottom, (int)ScreenHeight); line++) {
+            if (lineSpriteCounts[line] < 10) {
+                lineSprites[line][lineSpriteCounts[line]++] = j;
+            }
         }
-        visibleSprites[num++] = j;
     }
-    auto callback = [this](SByte i, SByte j) -> bool {
-        if (sprites[i].x < sprites[j].x) {
-            return true;
-        } else if (sprites[i].x == sprites[j].x) {
-            return i < j;
-        } else {
-            return false;
+
+    // ... and draws them ordered by X coordinate, then by OAM index. Insertion sort is
+    // stable, so sprites with equal X coordinates stay in OAM order.
+    for (unsigned line = 0; line < ScreenHeight; line++) {
+        SByte* list = lineSprites[line];
+        for (unsigned i = 1; i < lineSpriteCounts[line]; i++) {
+            SByte sprite = list[i];
+            unsigned k = i;
+            for (; k > 0 && sprites[list[k - 1]].x > sprites[sprite].x; k--) {
+                list[k] = list[k - 1];
+            }
+            list[k] = sprite;
         }
-    };
-    std::sort(visibleSprites, visibleSprites + num, callback);
-    for (int i = num; i < 10; ++i) {
+    }
+
+    spriteTableDirty = false;
+}
+
+void Gpu::captureSpriteState() {
+    if (spriteTableDirty) {
+        rebuildSpriteTable();
+    }
+
+    unsigned num = lineSpriteCounts[regs.ly];
+    std::memcpy(visibleSprites, lineSprites[regs.ly], num);
+    for (unsigned i = num; i < arraySize(visibleSprites); ++i) {
         visibleSprites[i] = -1;
     }
 }
 
 void Gpu::renderScanline() {
-    Byte* bgPatternBase = regs.bgPatternBaseSelect ? &vram[0x0] : &vram[0x1000];  // Bit 4
+    if (dirtyTiles.any()) {
+        decodeDirtyTiles();
+    }
+    if (hostColorsDirty) {
+        updateHostColors();
+    }
 
-    for (unsigned i = 0; i < ScreenWidth; i++) {
-        if (!regs.lcdEnabled || !regs.bgEnabled) {
-            GbColor zero {0};
-            framebuffer[regs.ly][i] = zero;
-            continue;
+    // Pick the model once per scanline instead of once per pixel
+    if (bus->isGbcMode()) {
+        renderScanline<Model_Cgb>();
+    } else {
+        renderScanline<Model_Dmg>();
+    }
+}
+
+void Gpu::setPixelFormat(PixelFormat pixelFormat) {
+    this->pixelFormat = pixelFormat;
+    std::memset(&framebuffer[0], 0, sizeof(framebuffer));
+    hostColorsDirty = true;
+    dirtyLines.set();
+    if (worker) {
+        worker->syncFrom(this);
+    }
+}
+
+void Gpu::setFrameHashing(bool frameHashing) {
+    this->frameHashing = frameHashing;
+    if (worker) {
+        worker->syncFrom(this);
+    }
+}
+
+void Gpu::setColorCorrection(bool colorCorrection) {
+    this->colorCorrection = colorCorrection;
+    hostColorsDirty = true;
+    if (worker) {
+        worker->syncFrom(this);
+    }
+}
+
+// Translates one palette entry into both host formats
+void Gpu::updateHostColor(unsigned index) {
+    unsigned r, g, b;
+    if (bus->isGbcMode()) {
+        Byte* palette = index < 32 ? &cgbBackgroundPalette[2 * index] : &cgbSpritePalette[2 * (index - 32)];
+        Word color = palette[0] | (palette[1] << 8);
+        hashColors[index] = color;
+        r = color & 0x1f;
+        g = (color >> 5) & 0x1f;
+        b = (color >> 10) & 0x1f;
+
+        if (colorCorrection) {
+            // Approximates the washed-out colors of the CGB LCD, still in 0-31 range
+            unsigned cr = (r * 13 + g * 2 + b) >> 4;
+            unsigned cg = (g * 3 + b) >> 2;
+            unsigned cb = (r * 3 + g * 2 + b * 11) >> 4;
+            r = cr;
+            g = cg;
+            b = cb;
         }
+        r = (r << 3) | (r >> 2);
+        g = (g << 3) | (g >> 2);
+        b = (b << 3) | (b >> 2);
+    } else {
+        // DMG mode only uses background palette 0 and sprite palettes 0 and 1
+        Byte palette = index < 32 ? regs.bgp : index < 36 ? regs.obp0 : regs.obp1;
+        hashColors[index] = applyDmgPalette(palette, index % 4);
+        r = g = b = 255 - hashColors[index] * 85;
+    }
 
-        int scrollX, scrollY;
-        bool bgOrWinEnabled;
-        bool tileBaseSelector;
-        bool isWindow = false;
-        if (regs.winEnabled && regs.ly >= regs.wy && (int)i >= regs.wx - 7) {
-            scrollX = -regs.wx + 7;
-            scrollY = -regs.wy;
-            bgOrWinEnabled = true;
-            isWindow = true;
-            tileBaseSelector = regs.winTileBaseSelect; // Bit 6
-        } else {
-            scrollX = regs.scx;
-            scrollY = regs.scy;
-            bgOrWinEnabled = regs.bgEnabled;
-            tileBaseSelector = regs.bgTileBaseSelect; // Bit 3
+    hostColors32[index] = (r << 16) | (g << 8) | b;
+    hostColors16[index] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+}
+
+void Gpu::updateHostColors() {
+    for (unsigned i = 0; i < 64; i++) {
+        updateHostColor(i);
+    }
+    hostColorsDirty = false;
+}
+
+// Renders columns [from, to) of the background or the window, fetching each tile once per 8-pixel span.
+// Each pixel becomes a color table index.
+template<GbModel Model>
+void Gpu::renderBackgroundSpans(Byte* pixels, unsigned from, unsigned to,
+        unsigned tileMapOffset, unsigned bgX, unsigned bgY, bool hasAttrs) {
+    int bgPatternBase = regs.bgPatternBaseSelect ? 0 : 256;  // Bit 4, in tiles
+    Byte* tileMapRow = &vram[tileMapOffset + (bgY / 8) % 32 * 32];
+
+    for (unsigned i = from; i < to; ) {
+        unsigned bgTileX = (bgX / 8) % 32;
+        unsigned bgTileXBit = bgX % 8;
+
+        Byte tileNum = tileMapRow[bgTileX];
+        int tileOff = regs.bgPatternBaseSelect ? (int)tileNum : (int)(SByte)tileNum;
+        OamEntry::OamFlags attrs;
+        attrs.byteVal = (hasAttrs && Model == Model_Cgb) ? tileMapRow[8192 + bgTileX] : 0;
+        const Byte* row = tileRow<Model>(bgPatternBase + tileOff, bgY % 8, false, attrs);
+
+        unsigned n = std::min(8 - bgTileXBit, to - i);
+        for (unsigned k = 0; k < n; k++) {
+            pixels[i + k] = attrs.cgbPalette * 4 + row[bgTileXBit + k];
         }
-        Byte* bgTileBase = tileBaseSelector ? &vram[0x1c00] : &vram[0x1800];    // Bit 3/6
-        unsigned bgY = regs.ly + scrollY;
-        unsigned bgTileY = (bgY / 8) % 32;
-        unsigned bgTileYBit = bgY % 8;
-
-        Byte bgColor = 0;
-        GbColor pixel {0};
-        if (bgOrWinEnabled) {
-            unsigned bgX = i + scrollX;
-            unsigned bgTileX = (bgX / 8) % 32;
-            unsigned bgTileXBit = bgX % 8;
-
-            unsigned int tileIndex = bgTileY * 32 + bgTileX;
-            Byte tileNum = bgTileBase[tileIndex];
-            long tileOff = regs.bgPatternBaseSelect ? (long)tileNum : (long)(SByte)tileNum;
-            OamEntry::OamFlags attrs;
-            attrs.byteVal = (!isWindow && bus->isGbcMode()) ? (bgTileBase + 8192)[tileIndex] : 0;
-            bgColor = drawTilePixel(bgPatternBase + 16 * tileOff, bgTileXBit, bgTileYBit, false, attrs);
-            if (bus->isGbcMode()) {
-                pixel = ((GbColor*)&cgbBackgroundPalette[0])[attrs.cgbPalette * 4 + bgColor];
-                pixel.isGrayscale = false;
-            } else {
-                pixel = applyDmgPalette(regs.bgp, bgColor);
+        i += n;
+        bgX += n;
+    }
+}
+
+// Draws the sprites of the current line into a line buffer of color table indices,
+// with bit 7 set for sprites behind the background, or 0 where there is no sprite.
+// Sprites are in priority order, so the first opaque pixel at each column wins,
+// even if it is later hidden behind the background.
+template<GbModel Model>
+void Gpu::renderSprites(Byte* pixels) {
+    std::memset(pixels, 0, ScreenWidth);
+
+    for (unsigned j = 0; j < arraySize(visibleSprites) && visibleSprites[j] >= 0; ++j) {
+        OamEntry* oamEntry = &sprites[visibleSprites[j]];
+
+        int tileY = regs.ly - (oamEntry->y - 16);
+        assert(tileY >= 0 && tileY < 16); // XXX: this assert has fired as well!
+        const Byte* row = tileRow<Model>(oamEntry->tile, tileY, regs.objSizeLarge, oamEntry->flags);
+
+        unsigned palette = Model == Model_Cgb ? oamEntry->flags.cgbPalette : oamEntry->flags.dmgPalette;
+        Byte spriteBits = (oamEntry->flags.lowPriority << 7) | (32 + palette * 4);
+
+        int left = oamEntry->x - 8;
+        for (int k = std::max(0, -left); k < 8 && left + k < ScreenWidth; k++) {
+            if (row[k] && !pixels[left + k]) {
+                pixels[left + k] = spriteBits | row[k];
             }
         }
+    }
+}
+
+void Gpu::updateLine(const void* line) {
+    Byte* dest = &framebuffer[regs.ly * getFramebufferPitch()];
+    if (std::memcmp(dest, line, getFramebufferPitch())) {
+        std::memcpy(dest, line, getFramebufferPitch());
+        dirtyLines.set(regs.ly);
+    }
+}
+
+template<GbModel Model>
+void Gpu::renderScanline() {
+    // Drawn aside first, so that the line is only marked dirty if it has changed
+    uint32_t line[ScreenWidth];
+
+    if (!regs.lcdEnabled || !regs.bgEnabled) {
+        // Blank lines are white
+        if (pixelFormat == PixelFormat_Rgb565) {
+            std::fill_n((Word*)line, (int)ScreenWidth, 0xffff);
+        } else {
+            std::fill_n(line, (int)ScreenWidth, 0xffffff);
+        }
+        updateLine(line);
+        if (frameHashing) {
+            std::fill_n(&hashFrame[regs.ly * ScreenWidth], (int)ScreenWidth, 0xffff);
+        }
+        return;
+    }
+
+    Byte bgPixels[ScreenWidth];
+    unsigned winStart = ScreenWidth;
+    if (regs.winEnabled && regs.ly >= regs.wy) {
+        winStart = clamp(regs.wx - 7, 0, (int)ScreenWidth);
+    }
+
+    renderBackgroundSpans<Model>(bgPixels, 0, winStart,
+            regs.bgTileBaseSelect ? 0x1c00 : 0x1800,    // Bit 3
+            regs.scx, regs.ly + regs.scy, true);
+    if (winStart < ScreenWidth) {
+        renderBackgroundSpans<Model>(bgPixels, winStart, ScreenWidth,
+                regs.winTileBaseSelect ? 0x1c00 : 0x1800,   // Bit 6
+                winStart + 7 - regs.wx, regs.ly - regs.wy, false);
+    }
+
+    Byte spritePixels[ScreenWidth];
+    if (regs.objEnabled) {
+        renderSprites<Model>(spritePixels);
+    } else {
+        std::memset(spritePixels, 0, sizeof(spritePixels));
+    }
+
+    if (pixelFormat == PixelFormat_Rgb565) {
+        PixelKernels::composeLine16((Word*)line, bgPixels, spritePixels, hostColors16, ScreenWidth);
+    } else {
+        PixelKernels::composeLine32(line, bgPixels, spritePixels, hostColors32, ScreenWidth);
+    }
+    updateLine(line);
+    if (frameHashing) {
+        PixelKernels::composeLine16(&hashFrame[regs.ly * ScreenWidth], bgPixels, spritePixels, hashColors,
+                ScreenWidth);
+    }
+}
+
+// Called before every write that could change the pixels of the current line
+void Gpu::syncLineBeforeWrite() {
+    if (!accurateRendering || worker || !renderEnabled || skipFrame || regs.ly >= ScreenHeight
+            || cycleResidue < OamFetchThresholdCycles || cycleResidue >= VramFetchThresholdCycles) {
+        return;
+    }
+
+    unsigned x = clamp(cycleResidue - FirstPixelCycles, 0, (int)ScreenWidth);
+    if (bus->isGbcMode()) {
+        if (!fifoActive) {
+            beginFifoLine<Model_Cgb>();
+        }
+        fifoCatchUp<Model_Cgb>(x);
+    } else {
+        if (!fifoActive) {
+            beginFifoLine<Model_Dmg>();
+        }
+        fifoCatchUp<Model_Dmg>(x);
+    }
+}
 
-        for (int j = 0; regs.objEnabled && j < 10 && visibleSprites[j] >= 0; ++j) {
-            OamEntry* oamEntry = &sprites[visibleSprites[j]];
+void Gpu::finishFifoLine() {
+    if (bus->isGbcMode()) {
+        fifoCatchUp<Model_Cgb>(ScreenWidth);
+    } else {
+        fifoCatchUp<Model_Dmg>(ScreenWidth);
+    }
+    updateLine(fifoLine);
+    fifoActive = false;
+}
+
+// Sets up the FIFO with the state at the start of mode 3, which hasn't changed yet
+template<GbModel Model>
+void Gpu::beginFifoLine() {
+    if (dirtyTiles.any()) {
+        decodeDirtyTiles();
+    }
+    renderSprites<Model>(fifoSprites);
+
+    fifoActive = true;
+    fifoX = 0;
+    fifoPos = 8;
+    fifoTilesFetched = 0;
+    fifoDiscard = regs.scx % 8;
+    fifoInWindow = false;
+}
+
+// Fetches the next 8 pixels, using the registers as they are at the time of the fetch
+template<GbModel Model>
+void Gpu::fifoFetch() {
+    if (dirtyTiles.any()) {
+        decodeDirtyTiles();
+    }
+
+    unsigned tileMapOffset, tileX, y;
+    if (fifoInWindow) {
+        tileMapOffset = regs.winTileBaseSelect ? 0x1c00 : 0x1800;
+        tileX = fifoTilesFetched % 32;
+        y = regs.ly - regs.wy;
+    } else {
+        tileMapOffset = regs.bgTileBaseSelect ? 0x1c00 : 0x1800;
+        tileX = (regs.scx / 8 + fifoTilesFetched) % 32;
+        y = (regs.ly + regs.scy) % 256;
+    }
+    Byte* tileMapEntry = &vram[tileMapOffset + y / 8 * 32 + tileX];
+
+    Byte tileNum = *tileMapEntry;
+    int tileOff = regs.bgPatternBaseSelect ? (int)tileNum : (int)(SByte)tileNum;
+    OamEntry::OamFlags attrs;
+    attrs.byteVal = (!fifoInWindow && Model == Model_Cgb) ? tileMapEntry[8192] : 0;
+    const Byte* row = tileRow<Model>((regs.bgPatternBaseSelect ? 0 : 256) + tileOff, y % 8, false, attrs);
+
+    for (unsigned k = 0; k < 8; k++) {
+        fifoPixels[k] = attrs.cgbPalette * 4 + row[k];
+    }
+    fifoPos = 0;
+    fifoTilesFetched++;
+}
+
+// Outputs pixels up to (not including) toX
+template<GbModel Model>
+void Gpu::fifoCatchUp(unsigned toX) {
+    if (hostColorsDirty) {
+        updateHostColors();
+    }
+
+    while (fifoX < toX) {
+        // The window restarts the fetcher once it's reached
+        if (!fifoInWindow && regs.winEnabled && regs.ly >= regs.wy && (int)fifoX >= regs.wx - 7) {
+            fifoInWindow = true;
+            fifoPos = 8;
+            fifoTilesFetched = 0;
+            fifoDiscard = fifoX + 7 - regs.wx;
+        }
+        if (fifoPos == 8) {
+            fifoFetch<Model>();
+        }
+
+        Byte bgPixel = fifoPixels[fifoPos++];
+        if (fifoDiscard) {
+            fifoDiscard--;
+            continue;
+        }
 
-            int tileX = i - (oamEntry->x - 8);
-            if (tileX < 0 || tileX >= 8) {
-                continue;
+        // Colors are looked up as each pixel leaves the FIFO, so palette changes are exact
+        Byte spritePixel = regs.objEnabled ? fifoSprites[fifoX] : 0;
+        bool blank = !regs.lcdEnabled || !regs.bgEnabled;
+        if (pixelFormat == PixelFormat_Rgb565) {
+            Word* out = (Word*)fifoLine + fifoX;
+            if (blank) {
+                *out = 0xffff;
+            } else {
+                PixelKernels::composeLineScalar(out, &bgPixel, &spritePixel, hostColors16, 1);
             }
-            int tileY = regs.ly - (oamEntry->y - 16);
-            assert(tileY >= 0 && tileY < 16); // XXX: this assert has fired as well!
-
-            Byte spriteColor = drawTilePixel(&vram[16 * oamEntry->tile], tileX, tileY,
-                    regs.objSizeLarge, oamEntry->flags);
-            GbColor spritePixel;
-            if (bus->isGbcMode()) {
-                spritePixel = ((GbColor*)&cgbSpritePalette[0])[oamEntry->flags.cgbPalette * 4 + spriteColor];
+        } else {
+            uint32_t* out = fifoLine + fifoX;
+            if (blank) {
+                *out = 0xffffff;
             } else {
-                Byte dmgPalette = oamEntry->flags.dmgPalette ? regs.obp1 : regs.obp0;
-                spritePixel = applyDmgPalette(dmgPalette, spriteColor);
+                PixelKernels::composeLineScalar(out, &bgPixel, &spritePixel, hostColors32, 1);
             }
-            if (spriteColor != 0 && (!oamEntry->flags.lowPriority || bgColor == 0)) {
-                pixel = spritePixel;
-                break;
+        }
+        if (frameHashing) {
+            Word* out = &hashFrame[regs.ly * ScreenWidth + fifoX];
+            if (blank) {
+                *out = 0xffff;
+            } else {
+                PixelKernels::composeLineScalar(out, &bgPixel, &spritePixel, hashColors, 1);
             }
         }
-
-        framebuffer[regs.ly][i] = pixel;
+        fifoX++;
     }
 }
 
+template<GbModel Model>
 void Gpu::vramAccess(Word offset, Byte* pData, bool isWrite) {
 #if 0
     if (isWrite)
         log->warn("GPU VRAM write [0x%0x] = 0x%02x", 0x8000 + offset, *pData);
 #endif
-    BusUtil::arrayMemAccess(&vram[bus->isGbcMode() && regs.vramBank ? 8192 : 0], offset, pData, isWrite);
+    unsigned bank = Model == Model_Cgb && regs.vramBank ? 1 : 0;
+    if (isWrite) {
+        syncLineBeforeWrite();
+    }
+    BusUtil::arrayMemAccess(&vram[bank * 8192], offset, pData, isWrite);
+    if (isWrite && offset < TilesPerBank * 16) {
+        dirtyTiles.set(bank * TilesPerBank + offset / 16);
+    }
+    if (isWrite) {
+        generations.vram++;
+        if (worker) {
+            worker->recordWrite(GpuCommand::VramWrite, bank * 8192 + offset, *pData);
+        }
+    }
 }
 
+template void Gpu::vramAccess<Model_Dmg>(Word offset, Byte* pData, bool isWrite);
+template void Gpu::vramAccess<Model_Cgb>(Word offset, Byte* pData, bool isWrite);
+
 void Gpu::oamAccess(Word offset, Byte* pData, bool isWrite) {
 #if 0
     if (isWrite)
         log->warn("GPU OAM write [0x%0x] = 0x%02x", 0xfe00 + offset, *pData);
 #endif
     BusUtil::arrayMemAccess(oam, offset, pData, isWrite);
+    if (isWrite) {
+        spriteTableDirty = true;
+        if (worker) {
+            worker->recordWrite(GpuCommand::OamWrite, offset, *pData);
+        }
+    }
 }
 
 static void accessPaletteIndexReg(Byte* palette, PaletteIndexReg* paletteReg, Byte* pData, bool isWrite) {
@@ -237,22 +610,62 @@ void Gpu::registerAccess(Word reg, Byte* pData, bool isWrite) {
             case 0xff68:
                 BusUtil::simpleRegAccess(&regs.cgbBackgroundPaletteIndex.raw, pData, isWrite, 0xbf);
                 return;
-            case 0xff69:
+            case 0xff69: {
+                if (isWrite) {
+                    syncLineBeforeWrite();
+                }
+                unsigned index = regs.cgbBackgroundPaletteIndex.index;
                 accessPaletteIndexReg(cgbBackgroundPalette, &regs.cgbBackgroundPaletteIndex, pData, isWrite);
+                if (isWrite) {
+                    updateHostColor(index / 2);
+                    generations.palettes++;
+                    if (worker) {
+                        worker->recordWrite(GpuCommand::BgPaletteWrite, index, *pData);
+                    }
+                }
                 return;
+            }
             case 0xff6a:
                 BusUtil::simpleRegAccess(&regs.cgbSpritePaletteIndex.raw, pData, isWrite, 0xbf);
                 return;
-            case 0xff6b:
+            case 0xff6b: {
+                if (isWrite) {
+                    syncLineBeforeWrite();
+                }
+                unsigned index = regs.cgbSpritePaletteIndex.index;
                 accessPaletteIndexReg(cgbSpritePalette, &regs.cgbSpritePaletteIndex, pData, isWrite);
+                if (isWrite) {
+                    updateHostColor(32 + index / 2);
+                    generations.palettes++;
+                    if (worker) {
+                        worker->recordWrite(GpuCommand::SpritePaletteWrite, index, *pData);
+                    }
+                }
                 return;
+            }
+        }
+    }
+
+    if (isWrite) {
+        switch (reg) {
+            case 0xff40: case 0xff42: case 0xff43: case 0xff47: case 0xff48: case 0xff49: case 0xff4a: case 0xff4b:
+                syncLineBeforeWrite();
+                break;
         }
     }
 
     switch (reg) {
-        case 0xff40:
+        case 0xff40: {
+            GpuRegs old = regs;
             BusUtil::simpleRegAccess(&regs.lcdc, pData, isWrite);
+            if (regs.objSizeLarge != old.objSizeLarge) {
+                spriteTableDirty = true;
+            }
+            if (regs.bgTileBaseSelect != old.bgTileBaseSelect || regs.bgPatternBaseSelect != old.bgPatternBaseSelect) {
+                generations.tileMapSelect++;
+            }
             return;
+        }
         case 0xff41: {
             if (isWrite) {
                 regs.stat = *pData & 0xf8;
@@ -289,12 +702,36 @@ void Gpu::registerAccess(Word reg, Byte* pData, bool isWrite) {
             return;
         case 0xff47:
             BusUtil::simpleRegAccess(&regs.bgp, pData, isWrite);
+            if (isWrite) {
+                generations.palettes++;
+            }
+            if (isWrite && !bus->isGbcMode()) {
+                for (unsigned i = 0; i < 4; i++) {
+                    updateHostColor(i);
+                }
+            }
             return;
         case 0xff48:
             BusUtil::simpleRegAccess(&regs.obp0, pData, isWrite);
+            if (isWrite) {
+                generations.palettes++;
+            }
+            if (isWrite && !bus->isGbcMode()) {
+                for (unsigned i = 0; i < 4; i++) {
+                    updateHostColor(32 + i);
+                }
+            }
             return;
         case 0xff49:
             BusUtil::simpleRegAccess(&regs.obp1, pData, isWrite);
+            if (isWrite) {
+                generations.palettes++;
+            }
+            if (isWrite && !bus->isGbcMode()) {
+                for (unsigned i = 0; i < 4; i++) {
+                    updateHostColor(36 + i);
+                }
+            }
             return;
         case 0xff4a:
             BusUtil::simpleRegAccess(&regs.wy, pData, isWrite);
@@ -307,6 +744,15 @@ void Gpu::registerAccess(Word reg, Byte* pData, bool isWrite) {
 }
 
 void Gpu::serialize(Serializer& ser) {
+    // A line that was being drawn by the FIFO is simply rendered whole
+    fifoActive = false;
+    generations.vram++;
+    generations.tileMapSelect++;
+    generations.palettes++;
+    if (worker) {
+        worker->collectFrame(this);
+    }
+
     ser.handleObject("Gpu.frame", frame);
     ser.handleObject("Gpu.cycleResidue", cycleResidue);
     ser.handleObject("Gpu.framebuffer", framebuffer);
@@ -316,4 +762,12 @@ void Gpu::serialize(Serializer& ser) {
     ser.handleObject("Gpu.oam", oam);
     ser.handleObject("Gpu.cgbBackgroundPalette", cgbBackgroundPalette);
     ser.handleObject("Gpu.cgbSpritePalette", cgbSpritePalette);
+
+    dirtyTiles.set();
+    spriteTableDirty = true;
+    hostColorsDirty = true;
+    dirtyLines.set();
+    if (worker) {
+        worker->syncFrom(this);
+    }
 }
@@ -2,48 +2,34 @@
 
 #include "Bus.hpp"
 #include "BusUtil.hpp"
+#include "FrameExchange.hpp"
+#include "FrameSkipper.hpp"
 #include "Irq.hpp"
 #include "Logger.hpp"
 #include "Platform.hpp"
 #include "Serializer.hpp"
 
+#include <bitset>
 #include <cstring>
+#include <memory>
 
 enum {
     ScreenWidth = 160,
     ScreenHeight = 144,
 
     ScanlineCycles = 456,
+
+    TilesPerBank = 384,
 };
 
-union GbColor {
-    struct {
-        unsigned r : 5;
-        unsigned g : 5;
-        unsigned b : 5;
-        unsigned isGrayscale : 1;
-    }__attribute__((packed));
-    struct {
-        unsigned dmgGrayscale : 2;
-        unsigned pad : 14;
-    }__attribute__((packed));
+// Hands complete frames of the largest pixel format over to the frontend
+typedef FrameExchange<ScreenHeight * ScreenWidth * 4, ScreenHeight> LcdFrameExchange;
 
-    explicit GbColor() {
-        this->isGrayscale = true;
-        this->dmgGrayscale = 0;
-    }
-    explicit GbColor(unsigned grayscale) {
-        this->isGrayscale = true;
-        this->dmgGrayscale = grayscale;
-    }
-    explicit GbColor(unsigned r, unsigned g, unsigned b) {
-        this->isGrayscale = false;
-        this->r = r;
-        this->g = g;
-        this->b = b;
-    }
-} __attribute__((packed));
-static_assert(sizeof(GbColor) == 2, "GbColor is wrong");
+// Layout of the pixels the core writes into the framebuffer, native to the host frontend
+enum PixelFormat {
+    PixelFormat_Xrgb8888,   // 32 bits per pixel, 0x00RRGGBB
+    PixelFormat_Rgb565,     // 16 bits per pixel
+};
 
 struct OamEntry {
     Byte y;
@@ -117,15 +103,35 @@ struct GpuRegs {
     PaletteIndexReg cgbSpritePaletteIndex;
 };
 
+// Counters bumped whenever state shown by the debug viewers changes
+struct GpuGenerations {
+    unsigned vram;
+    unsigned tileMapSelect;     // LCDC tile map and tile data selection
+    unsigned palettes;
+};
+
+class GpuWorker;
+
 class Gpu {
+    friend class GpuWorker;
+
     Logger* log;
     Bus* bus;
 
     bool renderEnabled;
+    FrameSkipper frameSkipper;
+    bool skipFrame;         // current frame is emulated, but not drawn
+    bool lastFrameSkipped;
     long frame;
     int cycleResidue;
-    GbColor framebuffer[ScreenHeight][ScreenWidth];
-    SByte visibleSprites[40];
+    PixelFormat pixelFormat;
+    bool colorCorrection;
+    Byte framebuffer[ScreenHeight * ScreenWidth * 4];     // the frame being drawn
+    std::bitset<ScreenHeight> dirtyLines;   // lines changed in the current frame
+    LcdFrameExchange frameExchange;
+    // Sprites found by the OAM scan of the current line, -1 after the last one. Unlike
+    // lineSprites, OAM writes later in the line don't change which sprites are drawn.
+    SByte visibleSprites[10];
 
     GpuRegs regs;
     Byte vram[16384];
@@ -136,39 +142,111 @@ class Gpu {
     Byte cgbBackgroundPalette[64];
     Byte cgbSpritePalette[64];
 
+    // Tile data of both VRAM banks decoded into color indices, both as-is and X-flipped.
+    // A tile is re-decoded before rendering only if VRAM writes have touched it.
+    Byte decodedTiles[2 * TilesPerBank][2][8][8];
+    std::bitset<2 * TilesPerBank> dirtyTiles;
+
+    // Up to 10 sprites visible on each line, in drawing priority order.
+    // Rebuilt lazily after OAM or the sprite size has changed.
+    SByte lineSprites[ScreenHeight][10];
+    Byte lineSpriteCounts[ScreenHeight];
+    bool spriteTableDirty;
+
+    // Palettes translated to host colors: background palettes at 0-31, sprite palettes at 32-63.
+    // Entries are updated when the palette registers are written.
+    uint32_t hostColors32[64];
+    Word hostColors16[64];
+    bool hostColorsDirty;
+
+    GpuGenerations generations;
+
+    // Hash of each drawn frame taken at VBlank, for regression checks. It covers the colors
+    // as the game set them (CGB RGB555 values, or DMG shades), so that it doesn't depend on
+    // the host pixel format or color correction.
+    bool frameHashing;
+    uint64_t frameHash;
+    Word hashColors[64];    // like hostColors
+    Word hashFrame[ScreenHeight * ScreenWidth];     // only drawn into while frameHashing
+
+    // Renders lines on another thread when set, owned
+    std::unique_ptr<GpuWorker> worker;
+
+    // Pixel FIFO renderer. Lines are normally rendered whole at the start of HBlank,
+    // but a line on which PPU state is written during mode 3 is switched over to the
+    // FIFO, which outputs the pixels up to the current dot before each such write.
+    bool accurateRendering;
+    bool fifoActive;
+    unsigned fifoX;                 // next pixel to output
+    Byte fifoPixels[8];             // background or window pixels of the last fetched tile
+    unsigned fifoPos;               // next pixel in fifoPixels, 8 when empty
+    unsigned fifoTilesFetched;      // since the start of the line or the window
+    unsigned fifoDiscard;           // pixels scrolled out to the left
+    bool fifoInWindow;
+    Byte fifoSprites[ScreenWidth];
+    uint32_t fifoLine[ScreenWidth];
+
+    void decodeDirtyTiles();
+    void updateLine(const void* line);
+
+    void syncLineBeforeWrite();
+    void finishFifoLine();
+    template<GbModel Model>
+    void beginFifoLine();
+    template<GbModel Model>
+    void fifoFetch();
+    template<GbModel Model>
+    void fifoCatchUp(unsigned toX);
+    void renderScanline();
+    template<GbModel Model>
     void renderScanline();
+    void rebuildSpriteTable();
     void captureSpriteState();
 
-    Byte drawTilePixel(Byte* tile, unsigned x, unsigned y, bool large=false,
+    void updateHostColor(unsigned index);
+    void updateHostColors();
+    template<GbModel Model>
+    void renderBackgroundSpans(Byte* pixels, unsigned from, unsigned to,
+            unsigned tileMapOffset, unsigned bgX, unsigned bgY, bool hasAttrs);
+    template<GbModel Model>
+    void renderSprites(Byte* pixels);
+
+    template<GbModel Model>
+    const Byte* tileRow(unsigned tileIndex, unsigned y, bool large=false,
             OamEntry::OamFlags flags=OamEntry::OamFlags());
 
 public:
-    Gpu(Logger* log, Bus* bus) :
-            log(log),
-            bus(bus),
-            renderEnabled(true),
-            frame(0),
-            cycleResidue(0) {
-        std::memset(&framebuffer[0][0], 0, sizeof(framebuffer));
-        std::memset(&vram[0], 0, sizeof(vram));
-        std::memset(&oam[0], 0, sizeof(oam));
-        std::memset(&cgbBackgroundPalette[0], 0, sizeof(cgbBackgroundPalette));
-        std::memset(&cgbSpritePalette[0], 0, sizeof(cgbSpritePalette));
-        std::memset(&regs, 0, sizeof(regs));
-        std::memset(&visibleSprites[0], 0, sizeof(visibleSprites));
-    }
+    Gpu(Logger* log, Bus* bus);
+    ~Gpu();
 
-    static inline GbColor applyDmgPalette(Byte palette, Byte colorIndex) {
-        return GbColor((palette >> colorIndex * 2) & 0x3);
+    static inline Byte applyDmgPalette(Byte palette, Byte colorIndex) {
+        return (palette >> colorIndex * 2) & 0x3;
     }
 
     int getCurrentScanline() { return regs.ly; }
     int getCurrentFrame() { return frame; }
-    Word* getFramebuffer() { return (Word*)&framebuffer[0][0]; }
+    const Byte* getFramebuffer() { return framebuffer; }
+    unsigned getFramebufferPitch() { return ScreenWidth * (pixelFormat == PixelFormat_Rgb565 ? 2 : 4); }
+    PixelFormat getPixelFormat() { return pixelFormat; }
+    void setPixelFormat(PixelFormat pixelFormat);
+    void setColorCorrection(bool colorCorrection);
+    void setThreadedRendering(bool threaded);
+    void setAccurateRendering(bool accurateRendering) { this->accurateRendering = accurateRendering; }
+    bool isThreadedRendering() { return worker != nullptr; }
+
+    // Complete frames, published at VBlank; safe to read from another thread
+    LcdFrameExchange* getFrameExchange() { return &frameExchange; }
     Byte* getVram() { return vram; }
     GpuRegs* getRegs() { return &regs; }
+    const GpuGenerations& getGenerations() { return generations; }
     void setRenderEnabled(bool renderEnabled) { this->renderEnabled = renderEnabled; }
+    FrameSkipper* getFrameSkipper() { return &frameSkipper; }
+    bool wasLastFrameSkipped() { return lastFrameSkipped; }
+    void setFrameHashing(bool frameHashing);
+    // 0 after frames that were skipped or not drawn at all
+    uint64_t getFrameHash() { return frameHash; }
 
+    template<GbModel Model>
     void vramAccess(Word offset, Byte* pData, bool isWrite);
     void oamAccess(Word offset, Byte* pData, bool isWrite);
     void registerAccess(Word reg, Byte* pData, bool isWrite);
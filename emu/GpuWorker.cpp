@@ -0,0 +1,151 @@
+#include "GpuWorker.hpp"
+
+GpuWorker::GpuWorker(Logger* log, Bus* bus) :
+        shadow(log, bus),
+        busy(false),
+        quit(false),
+        thread(&GpuWorker::run, this) {
+}
+
+GpuWorker::~GpuWorker() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wakeup.notify_one();
+    thread.join();
+}
+
+// Hands everything recorded so far over to the render thread
+void GpuWorker::submit() {
+    if (recording.empty()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (submitted.empty()) {
+            std::swap(submitted, recording);
+        } else {
+            // The render thread is behind; append, renumbering the snapshots
+            Word base = submitted.snapshots.size();
+            for (GpuCommand& command : recording.commands) {
+                if (command.type == GpuCommand::CaptureSprites || command.type == GpuCommand::RenderLine) {
+                    command.offset += base;
+                }
+            }
+            submitted.commands.insert(submitted.commands.end(),
+                    recording.commands.begin(), recording.commands.end());
+            submitted.snapshots.insert(submitted.snapshots.end(),
+                    recording.snapshots.begin(), recording.snapshots.end());
+        }
+    }
+    recording.clear();
+    wakeup.notify_one();
+}
+
+void GpuWorker::waitIdle() {
+    submit();
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return submitted.empty() && !busy; });
+}
+
+void GpuWorker::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wakeup.wait(lock, [this] { return !submitted.empty() || quit; });
+        if (submitted.empty()) {
+            return;
+        }
+
+        std::swap(processing, submitted);
+        busy = true;
+        lock.unlock();
+
+        execute(processing);
+        processing.clear();
+
+        lock.lock();
+        busy = false;
+        idle.notify_all();
+    }
+}
+
+void GpuWorker::applyRegs(const GpuRegs& regs) {
+    if (regs.objSizeLarge != shadow.regs.objSizeLarge) {
+        shadow.spriteTableDirty = true;
+    }
+    bool palettesChanged = regs.bgp != shadow.regs.bgp || regs.obp0 != shadow.regs.obp0
+            || regs.obp1 != shadow.regs.obp1;
+    shadow.regs = regs;
+
+    if (palettesChanged && !shadow.bus->isGbcMode()) {
+        shadow.hostColorsDirty = true;
+    }
+}
+
+void GpuWorker::execute(GpuCommandBatch& batch) {
+    for (const GpuCommand& command : batch.commands) {
+        switch (command.type) {
+            case GpuCommand::VramWrite:
+                shadow.vram[command.offset] = command.value;
+                if (command.offset % 8192 < TilesPerBank * 16) {
+                    shadow.dirtyTiles.set(command.offset / 8192 * TilesPerBank + command.offset % 8192 / 16);
+                }
+                break;
+            case GpuCommand::OamWrite:
+                shadow.oam[command.offset] = command.value;
+                shadow.spriteTableDirty = true;
+                break;
+            case GpuCommand::BgPaletteWrite:
+                shadow.cgbBackgroundPalette[command.offset] = command.value;
+                shadow.updateHostColor(command.offset / 2);
+                break;
+            case GpuCommand::SpritePaletteWrite:
+                shadow.cgbSpritePalette[command.offset] = command.value;
+                shadow.updateHostColor(32 + command.offset / 2);
+                break;
+            case GpuCommand::CaptureSprites:
+                applyRegs(batch.snapshots[command.offset]);
+                shadow.captureSpriteState();
+                break;
+            case GpuCommand::RenderLine:
+                applyRegs(batch.snapshots[command.offset]);
+                shadow.renderScanline();
+                break;
+        }
+    }
+}
+
+// Makes the shadow Gpu match gpu, e.g. after loading a saved state
+void GpuWorker::syncFrom(Gpu* gpu) {
+    waitIdle();
+
+    std::memcpy(shadow.vram, gpu->vram, sizeof(shadow.vram));
+    std::memcpy(shadow.oam, gpu->oam, sizeof(shadow.oam));
+    std::memcpy(shadow.cgbBackgroundPalette, gpu->cgbBackgroundPalette, sizeof(shadow.cgbBackgroundPalette));
+    std::memcpy(shadow.cgbSpritePalette, gpu->cgbSpritePalette, sizeof(shadow.cgbSpritePalette));
+    std::memcpy(shadow.framebuffer, gpu->framebuffer, sizeof(shadow.framebuffer));
+    std::memcpy(shadow.visibleSprites, gpu->visibleSprites, sizeof(shadow.visibleSprites));
+    shadow.regs = gpu->regs;
+    shadow.pixelFormat = gpu->pixelFormat;
+    shadow.colorCorrection = gpu->colorCorrection;
+    shadow.frameHashing = gpu->frameHashing;
+
+    shadow.dirtyTiles.set();
+    shadow.dirtyLines.reset();
+    shadow.spriteTableDirty = true;
+    shadow.hostColorsDirty = true;
+}
+
+// Waits for all lines recorded so far to be rendered, then copies them into gpu's framebuffer
+void GpuWorker::collectFrame(Gpu* gpu) {
+    waitIdle();
+
+    std::memcpy(gpu->framebuffer, shadow.framebuffer, sizeof(gpu->framebuffer));
+    if (gpu->frameHashing) {
+        std::memcpy(gpu->hashFrame, shadow.hashFrame, sizeof(gpu->hashFrame));
+    }
+    gpu->dirtyLines |= shadow.dirtyLines;
+    shadow.dirtyLines.reset();
+}
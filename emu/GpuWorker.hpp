@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Gpu.hpp"
+#include "Platform.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// One step of the stream the emulation thread sends to the render thread
+struct GpuCommand {
+    enum Type : Byte {
+        VramWrite,              // offset into both VRAM banks
+        OamWrite,
+        BgPaletteWrite,         // offset into CGB background palette memory
+        SpritePaletteWrite,
+        CaptureSprites,         // offset is the index of the register snapshot
+        RenderLine,
+    };
+
+    Type type;
+    Byte value;
+    Word offset;
+};
+
+struct GpuCommandBatch {
+    std::vector<GpuCommand> commands;
+    std::vector<GpuRegs> snapshots;     // register state at each CaptureSprites and RenderLine
+
+    bool empty() { return commands.empty(); }
+    void clear() {
+        commands.clear();
+        snapshots.clear();
+    }
+};
+
+// Renders scanlines on a separate thread, in parallel with the CPU emulation.
+// The worker owns a shadow Gpu, which it keeps in sync by replaying all writes to
+// VRAM, OAM and CGB palettes, and renders each line with a snapshot of the registers
+// taken at the time the emulated Gpu would have rendered it. The result is identical
+// to rendering the lines directly.
+class GpuWorker {
+    Gpu shadow;
+
+    GpuCommandBatch recording;      // only used by the emulation thread
+    GpuCommandBatch submitted;      // guarded by mutex
+    GpuCommandBatch processing;     // only used by the render thread
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::condition_variable idle;
+    bool busy;
+    bool quit;
+    std::thread thread;
+
+    void run();
+    void execute(GpuCommandBatch& batch);
+    void applyRegs(const GpuRegs& regs);
+
+public:
+    GpuWorker(Logger* log, Bus* bus);
+    ~GpuWorker();
+
+    void recordWrite(GpuCommand::Type type, Word offset, Byte value) {
+        recording.commands.push_back(GpuCommand { type, value, offset });
+    }
+    void recordLine(GpuCommand::Type type, const GpuRegs& regs) {
+        recording.commands.push_back(GpuCommand { type, 0, (Word)recording.snapshots.size() });
+        recording.snapshots.push_back(regs);
+    }
+
+    void submit();
+    void waitIdle();
+
+    void syncFrom(Gpu* gpu);
+    void collectFrame(Gpu* gpu);
+};
@@ -0,0 +1,81 @@
+#include "Joypad.hpp"
+#include "Utils.hpp"
+
+#include <limits>
+#include <sstream>
+
+static const char* keyNames[] = { "right", "left", "up", "down", "a", "b", "select", "start" };
+
+bool Joypad::queueEvent(const JoypadEvent& event) {
+    return events.push(event);
+}
+
+// Applies all queued events that are due at currentCycle. Events without a
+// timestamp are applied right now, and recorded with currentCycle. Returns true
+// if a key line went from high to low, i.e. the joypad IRQ should be raised.
+bool Joypad::processEvents(long currentCycle) {
+    bool irq = false;
+
+    while (JoypadEvent* event = events.peek()) {
+        if (event->cycle != JoypadEvent::AsSoonAsPossible && event->cycle > currentCycle) {
+            break;
+        }
+
+        Byte newKeys = event->pressed ? keys | event->keys : keys & ~event->keys;
+        Byte oldSt = getStateFor(keys);
+        Byte newSt = getStateFor(newKeys);
+        irq |= (oldSt ^ newSt) & oldSt;
+
+        keys = newKeys;
+        if (recording) {
+            recorded.push_back(JoypadEvent { currentCycle, event->keys, event->pressed });
+        }
+        events.pop();
+    }
+
+    return irq;
+}
+
+long Joypad::getNextEventCycle() {
+    JoypadEvent* event = events.peek();
+    if (!event) {
+        return std::numeric_limits<long>::max();
+    }
+    return event->cycle == JoypadEvent::AsSoonAsPossible ? 0 : event->cycle;
+}
+
+bool Joypad::parseEvent(const std::string& line, JoypadEvent* event) {
+    std::stringstream fields(line);
+    std::string action, names;
+    if (!(fields >> event->cycle >> action >> names) || (action != "press" && action != "release")) {
+        return false;
+    }
+    event->pressed = action == "press";
+
+    event->keys = 0;
+    std::stringstream stream(names);
+    std::string name;
+    while (std::getline(stream, name, '+')) {
+        unsigned i = 0;
+        while (i < arraySize(keyNames) && name != keyNames[i]) {
+            i++;
+        }
+        if (i == arraySize(keyNames)) {
+            return false;
+        }
+        event->keys |= bit(i);
+    }
+    return event->keys != 0;
+}
+
+std::string Joypad::formatEvent(const JoypadEvent& event) {
+    std::string line = std::to_string(event.cycle) + (event.pressed ? " press " : " release ");
+    bool first = true;
+    for (unsigned i = 0; i < arraySize(keyNames); i++) {
+        if (event.keys & bit(i)) {
+            line += (first ? "" : "+") + std::string(keyNames[i]);
+            first = false;
+        }
+    }
+    return line;
+}
@@ -2,6 +2,10 @@
 
 #include "Platform.hpp"
 #include "Serializer.hpp"
+#include "SpscQueue.hpp"
+
+#include <string>
+#include <vector>
 
 enum PadKeys {
     Pad_Right = 1 << 0,
@@ -16,11 +20,29 @@ enum PadKeys {
     Pad_AllKeys = 0xff,
 };
 
+struct JoypadEvent {
+    enum {
+        // Applied at the core's next input poll, at most a scanline later, and stamped
+        // with the cycle it was applied at when recorded
+        AsSoonAsPossible = -1,
+    };
+
+    long cycle;     // emulated cycle at which the event takes effect
+    Byte keys;
+    bool pressed;
+};
+
 class Joypad {
-    Byte currentKeys;   // state of keys pressed in GUI, 1 = pressed
-    Byte latestKeys;    // latest keys delivered to emulation core
+    Byte keys;      // keys pressed as seen by the emulation core, 1 = pressed
     Byte latches;
 
+    // Filled by the GUI (or an input file), drained by the emulation core
+    SpscQueue<JoypadEvent, 64> events;
+
+    // Events as applied, for replaying them later. Only used by the emulation thread.
+    bool recording;
+    std::vector<JoypadEvent> recorded;
+
     Byte getStateFor(Byte keys) {
         Byte v = 0x0f;
         if (!(latches & 0x1)) {
@@ -34,38 +56,46 @@ class Joypad {
 
 public:
     Joypad() :
-            currentKeys(0),
-            latestKeys(0),
-            latches(0) {
+            keys(0),
+            latches(0),
+            recording(false) {
     }
 
-    bool tick() {
-        Byte oldSt = getStateFor(latestKeys);
-        Byte newSt = getStateFor(currentKeys);
-        bool ret = (oldSt ^ newSt) & oldSt;
-
-        latestKeys = currentKeys;
-        return ret;
-    }
+    bool processEvents(long currentCycle);
+    long getNextEventCycle();
+    bool queueEvent(const JoypadEvent& event);
 
     void regAccess(Byte* pData, bool isWrite) {
         if (isWrite) {
             latches = (*pData >> 4) & 0x3;
         } else {
-            *pData = getStateFor(latestKeys) | (latches << 4);
+            *pData = getStateFor(keys) | (latches << 4);
         }
     }
 
     void keysPressed(Byte keys) {
-        currentKeys |= keys;
+        queueEvent(JoypadEvent { JoypadEvent::AsSoonAsPossible, keys, true });
     }
 
     void keysReleased(Byte keys) {
-        currentKeys &= ~keys;
+        queueEvent(JoypadEvent { JoypadEvent::AsSoonAsPossible, keys, false });
+    }
+
+    void setRecording(bool recording) { this->recording = recording; }
+    // Returns the events applied since the last call, all with the cycle they were applied at
+    std::vector<JoypadEvent> takeRecordedEvents() {
+        std::vector<JoypadEvent> taken;
+        taken.swap(recorded);
+        return taken;
     }
+
+    // Input file lines: `cycle press|release key[+key...]`, with keys among right, left,
+    // up, down, a, b, select and start
+    static bool parseEvent(const std::string& line, JoypadEvent* event);
+    static std::string formatEvent(const JoypadEvent& event);
+
     void serialize(Serializer& ser) {
-        ser.handleObject("Joypad.currentKeys", currentKeys);
-        ser.handleObject("Joypad.latestKeys", latestKeys);
+        ser.handleObject("Joypad.keys", keys);
         ser.handleObject("Joypad.latches", latches);
     }
 };
@@ -1,5 +1,6 @@
 #include "Bus.hpp"
 #include "Cpu.hpp"
+#include "Gameboy.hpp"
 #include "Gpu.hpp"
 
 #include <stdio.h>
@@ -24,6 +25,15 @@ void Logger::logInsn(Bus* bus, Regs* regs, int cycles, Word newPC, const char* f
     vsnprintf(buf, sizeof(buf), fmt, ap);
     va_end(ap);
 
+    // Timestamps are only computed here, so the core doesn't need to keep them up to date
+    long currentFrame = 0, currentCycle = 0;
+    int currentScanline = 0;
+    if (clock) {
+        currentFrame = clock->getGpu()->getCurrentFrame();
+        currentScanline = clock->getGpu()->getCurrentScanline();
+        currentCycle = clock->getCurrentCycle();
+    }
+
     logImpl("[insn %05ld/%03d/%08ld] 0x%04X: %8s => %-32s "
                     "A: 0x%02x | BC: 0x%04x | DE: 0x%04x | HL: 0x%04x | SP: 0x%04x | Flags: %c%c%c%c%c | Cycles: %d",
             currentFrame, currentScanline, currentCycle % ScanlineCycles,
@@ -6,10 +6,10 @@ union Regs;
 
 class Bus;
 
+class Gameboy;
+
 class Logger {
-    long currentFrame;
-    long currentCycle;
-    int currentScanline;
+    Gameboy* clock;     // source of the frame/scanline/cycle timestamps, may be null
 
 protected:
     virtual void logImpl(const char* format, ...) = 0;
@@ -18,13 +18,12 @@ public:
     bool insnLoggingEnabled;
 
     Logger() :
+            clock(nullptr),
             insnLoggingEnabled() {
     }
 
-    void setTimestamp(long frame, int scanline, long cycle) {
-        currentFrame = frame;
-        currentCycle = cycle;
-        currentScanline = scanline;
+    void setClockSource(Gameboy* gb) {
+        clock = gb;
     }
 
     void logInsn(Bus* bus, Regs* regs, int cycles, Word newPC, const char* fmt, ...);
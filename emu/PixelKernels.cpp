@@ -0,0 +1,244 @@
+#include "PixelKernels.hpp"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+void PixelKernels::decodeTileScalar(const Byte* tile, Byte* out, Byte* outFlipped) {
+    for (unsigned y = 0; y < 8; y++) {
+        Byte lsbs = tile[2 * y + 0];
+        Byte msbs = tile[2 * y + 1];
+        for (unsigned x = 0; x < 8; x++) {
+            Byte color = (!!(lsbs & (0x80 >> x))) | ((!!(msbs & (0x80 >> x))) << 1);
+            out[8 * y + x] = color;
+            outFlipped[8 * y + 7 - x] = color;
+        }
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+static inline __m128i broadcastRows(Byte row0, Byte row1) {
+    return _mm_set_epi64x(row1 * 0x0101010101010101ULL, row0 * 0x0101010101010101ULL);
+}
+
+// Two rows (16 pixels) per iteration: broadcast each bitplane byte, then test one bit per lane
+X86_TARGET("sse2")
+static void decodeTileSse2(const Byte* tile, Byte* out, Byte* outFlipped) {
+    const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i bitsFlipped = _mm_set_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi8(2);
+
+    for (unsigned y = 0; y < 8; y += 2) {
+        __m128i lsbs = broadcastRows(tile[2 * y + 0], tile[2 * y + 2]);
+        __m128i msbs = broadcastRows(tile[2 * y + 1], tile[2 * y + 3]);
+
+        __m128i colors = _mm_or_si128(
+                _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(lsbs, bits), bits), one),
+                _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(msbs, bits), bits), two));
+        __m128i colorsFlipped = _mm_or_si128(
+                _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(lsbs, bitsFlipped), bitsFlipped), one),
+                _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(msbs, bitsFlipped), bitsFlipped), two));
+
+        _mm_storeu_si128((__m128i*)&out[8 * y], colors);
+        _mm_storeu_si128((__m128i*)&outFlipped[8 * y], colorsFlipped);
+    }
+}
+
+// Splits the 64-entry color table into byte planes usable as pshufb lookup tables
+template<typename Pixel>
+static void splitColorTable(const Pixel* colorTable, Byte planes[][64]) {
+    for (unsigned i = 0; i < 64; i++) {
+        for (unsigned b = 0; b < sizeof(Pixel); b++) {
+            planes[b][i] = colorTable[i] >> (8 * b);
+        }
+    }
+}
+
+// Picks the visible layer of 16 pixels and returns their color table indices
+X86_TARGET("ssse3")
+static inline __m128i composeIndicesSsse3(const Byte* bg, const Byte* sprites) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i bgPixels = _mm_loadu_si128((const __m128i*)bg);
+    __m128i spritePixels = _mm_loadu_si128((const __m128i*)sprites);
+
+    __m128i bgTransparent = _mm_cmpeq_epi8(_mm_and_si128(bgPixels, _mm_set1_epi8(0x03)), zero);
+    __m128i inFront = _mm_or_si128(_mm_cmpgt_epi8(spritePixels, _mm_set1_epi8(-1)), bgTransparent);
+    __m128i spriteVisible = _mm_andnot_si128(_mm_cmpeq_epi8(spritePixels, zero), inFront);
+
+    return _mm_or_si128(_mm_and_si128(spriteVisible, _mm_and_si128(spritePixels, _mm_set1_epi8(0x7f))),
+            _mm_andnot_si128(spriteVisible, bgPixels));
+}
+
+// Looks up one byte plane of the color table for 16 indices, 16 table entries per pshufb
+X86_TARGET("ssse3")
+static inline __m128i lookupSsse3(__m128i index, const __m128i* table) {
+    __m128i entry = _mm_and_si128(index, _mm_set1_epi8(0x0f));
+    __m128i chunk = _mm_and_si128(index, _mm_set1_epi8(0x30));
+    __m128i result = _mm_setzero_si128();
+    for (unsigned c = 0; c < 4; c++) {
+        __m128i inChunk = _mm_cmpeq_epi8(chunk, _mm_set1_epi8(c << 4));
+        result = _mm_or_si128(result, _mm_and_si128(inChunk, _mm_shuffle_epi8(table[c], entry)));
+    }
+    return result;
+}
+
+X86_TARGET("ssse3")
+static void composeLine16Ssse3(Word* out, const Byte* bg, const Byte* sprites, const Word* colorTable, unsigned n) {
+    Byte planes[2][64];
+    splitColorTable(colorTable, planes);
+    __m128i tables[2][4];
+    for (unsigned b = 0; b < 2; b++) {
+        for (unsigned c = 0; c < 4; c++) {
+            tables[b][c] = _mm_loadu_si128((const __m128i*)&planes[b][16 * c]);
+        }
+    }
+
+    unsigned i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i index = composeIndicesSsse3(&bg[i], &sprites[i]);
+        __m128i b0 = lookupSsse3(index, tables[0]);
+        __m128i b1 = lookupSsse3(index, tables[1]);
+
+        _mm_storeu_si128((__m128i*)&out[i], _mm_unpacklo_epi8(b0, b1));
+        _mm_storeu_si128((__m128i*)&out[i + 8], _mm_unpackhi_epi8(b0, b1));
+    }
+
+    PixelKernels::composeLineScalar(out + i, bg + i, sprites + i, colorTable, n - i);
+}
+
+X86_TARGET("ssse3")
+static void composeLine32Ssse3(uint32_t* out, const Byte* bg, const Byte* sprites, const uint32_t* colorTable,
+        unsigned n) {
+    Byte planes[4][64];
+    splitColorTable(colorTable, planes);
+    __m128i tables[4][4];
+    for (unsigned b = 0; b < 4; b++) {
+        for (unsigned c = 0; c < 4; c++) {
+            tables[b][c] = _mm_loadu_si128((const __m128i*)&planes[b][16 * c]);
+        }
+    }
+
+    unsigned i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i index = composeIndicesSsse3(&bg[i], &sprites[i]);
+        __m128i b0 = lookupSsse3(index, tables[0]);
+        __m128i b1 = lookupSsse3(index, tables[1]);
+        __m128i b2 = lookupSsse3(index, tables[2]);
+        __m128i b3 = lookupSsse3(index, tables[3]);
+
+        __m128i w01Low = _mm_unpacklo_epi8(b0, b1), w01High = _mm_unpackhi_epi8(b0, b1);
+        __m128i w23Low = _mm_unpacklo_epi8(b2, b3), w23High = _mm_unpackhi_epi8(b2, b3);
+        _mm_storeu_si128((__m128i*)&out[i], _mm_unpacklo_epi16(w01Low, w23Low));
+        _mm_storeu_si128((__m128i*)&out[i + 4], _mm_unpackhi_epi16(w01Low, w23Low));
+        _mm_storeu_si128((__m128i*)&out[i + 8], _mm_unpacklo_epi16(w01High, w23High));
+        _mm_storeu_si128((__m128i*)&out[i + 12], _mm_unpackhi_epi16(w01High, w23High));
+    }
+
+    PixelKernels::composeLineScalar(out + i, bg + i, sprites + i, colorTable, n - i);
+}
+
+X86_TARGET("avx2")
+static inline __m256i composeIndicesAvx2(const Byte* bg, const Byte* sprites) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i bgPixels = _mm256_loadu_si256((const __m256i*)bg);
+    __m256i spritePixels = _mm256_loadu_si256((const __m256i*)sprites);
+
+    __m256i bgTransparent = _mm256_cmpeq_epi8(_mm256_and_si256(bgPixels, _mm256_set1_epi8(0x03)), zero);
+    __m256i inFront = _mm256_or_si256(_mm256_cmpgt_epi8(spritePixels, _mm256_set1_epi8(-1)), bgTransparent);
+    __m256i spriteVisible = _mm256_andnot_si256(_mm256_cmpeq_epi8(spritePixels, zero), inFront);
+
+    return _mm256_or_si256(_mm256_and_si256(spriteVisible, _mm256_and_si256(spritePixels, _mm256_set1_epi8(0x7f))),
+            _mm256_andnot_si256(spriteVisible, bgPixels));
+}
+
+// vpshufb looks up within each 128-bit lane, so the tables hold a copy per lane
+X86_TARGET("avx2")
+static inline __m256i lookupAvx2(__m256i index, const __m256i* table) {
+    __m256i entry = _mm256_and_si256(index, _mm256_set1_epi8(0x0f));
+    __m256i chunk = _mm256_and_si256(index, _mm256_set1_epi8(0x30));
+    __m256i result = _mm256_setzero_si256();
+    for (unsigned c = 0; c < 4; c++) {
+        __m256i inChunk = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(c << 4));
+        result = _mm256_or_si256(result, _mm256_and_si256(inChunk, _mm256_shuffle_epi8(table[c], entry)));
+    }
+    return result;
+}
+
+X86_TARGET("avx2")
+static void composeLine16Avx2(Word* out, const Byte* bg, const Byte* sprites, const Word* colorTable, unsigned n) {
+    Byte planes[2][64];
+    splitColorTable(colorTable, planes);
+    __m256i tables[2][4];
+    for (unsigned b = 0; b < 2; b++) {
+        for (unsigned c = 0; c < 4; c++) {
+            tables[b][c] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)&planes[b][16 * c]));
+        }
+    }
+
+    unsigned i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i index = composeIndicesAvx2(&bg[i], &sprites[i]);
+        __m256i b0 = lookupAvx2(index, tables[0]);
+        __m256i b1 = lookupAvx2(index, tables[1]);
+
+        // Unpacking works per lane; put the lanes back in pixel order
+        __m256i wLow = _mm256_unpacklo_epi8(b0, b1), wHigh = _mm256_unpackhi_epi8(b0, b1);
+        _mm256_storeu_si256((__m256i*)&out[i], _mm256_permute2x128_si256(wLow, wHigh, 0x20));
+        _mm256_storeu_si256((__m256i*)&out[i + 16], _mm256_permute2x128_si256(wLow, wHigh, 0x31));
+    }
+
+    composeLine16Ssse3(out + i, bg + i, sprites + i, colorTable, n - i);
+}
+
+X86_TARGET("avx2")
+static void composeLine32Avx2(uint32_t* out, const Byte* bg, const Byte* sprites, const uint32_t* colorTable,
+        unsigned n) {
+    Byte planes[4][64];
+    splitColorTable(colorTable, planes);
+    __m256i tables[4][4];
+    for (unsigned b = 0; b < 4; b++) {
+        for (unsigned c = 0; c < 4; c++) {
+            tables[b][c] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)&planes[b][16 * c]));
+        }
+    }
+
+    unsigned i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i index = composeIndicesAvx2(&bg[i], &sprites[i]);
+        __m256i b0 = lookupAvx2(index, tables[0]);
+        __m256i b1 = lookupAvx2(index, tables[1]);
+        __m256i b2 = lookupAvx2(index, tables[2]);
+        __m256i b3 = lookupAvx2(index, tables[3]);
+
+        __m256i w01Low = _mm256_unpacklo_epi8(b0, b1), w01High = _mm256_unpackhi_epi8(b0, b1);
+        __m256i w23Low = _mm256_unpacklo_epi8(b2, b3), w23High = _mm256_unpackhi_epi8(b2, b3);
+        __m256i d0 = _mm256_unpacklo_epi16(w01Low, w23Low), d1 = _mm256_unpackhi_epi16(w01Low, w23Low);
+        __m256i d2 = _mm256_unpacklo_epi16(w01High, w23High), d3 = _mm256_unpackhi_epi16(w01High, w23High);
+
+        _mm256_storeu_si256((__m256i*)&out[i], _mm256_permute2x128_si256(d0, d1, 0x20));
+        _mm256_storeu_si256((__m256i*)&out[i + 8], _mm256_permute2x128_si256(d2, d3, 0x20));
+        _mm256_storeu_si256((__m256i*)&out[i + 16], _mm256_permute2x128_si256(d0, d1, 0x31));
+        _mm256_storeu_si256((__m256i*)&out[i + 24], _mm256_permute2x128_si256(d2, d3, 0x31));
+    }
+
+    composeLine32Ssse3(out + i, bg + i, sprites + i, colorTable, n - i);
+}
+
+PixelKernels::DecodeTileFn PixelKernels::decodeTile =
+        selectForCpu<DecodeTileFn>(CpuFeature_Sse2, decodeTileSse2, decodeTileScalar);
+PixelKernels::ComposeLine16Fn PixelKernels::composeLine16 = selectForCpu<ComposeLine16Fn>(CpuFeature_Avx2,
+        composeLine16Avx2, selectForCpu<ComposeLine16Fn>(CpuFeature_Ssse3, composeLine16Ssse3, composeLineScalar<Word>));
+PixelKernels::ComposeLine32Fn PixelKernels::composeLine32 = selectForCpu<ComposeLine32Fn>(CpuFeature_Avx2,
+        composeLine32Avx2, selectForCpu<ComposeLine32Fn>(CpuFeature_Ssse3, composeLine32Ssse3, composeLineScalar<uint32_t>));
+
+#else
+
+PixelKernels::DecodeTileFn PixelKernels::decodeTile = decodeTileScalar;
+PixelKernels::ComposeLine16Fn PixelKernels::composeLine16 = composeLineScalar<Word>;
+PixelKernels::ComposeLine32Fn PixelKernels::composeLine32 = composeLineScalar<uint32_t>;
+
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Platform.hpp"
+
+// Inner loops of the scanline renderer, as SIMD kernels (see Platform.hpp)
+struct PixelKernels {
+    typedef void (*DecodeTileFn)(const Byte* tile, Byte* out, Byte* outFlipped);
+    typedef void (*ComposeLine16Fn)(Word* out, const Byte* bg, const Byte* sprites, const Word* colorTable,
+            unsigned n);
+    typedef void (*ComposeLine32Fn)(uint32_t* out, const Byte* bg, const Byte* sprites,
+            const uint32_t* colorTable, unsigned n);
+
+    // Decodes the 16 bitplane bytes of a tile into 8x8 color indices,
+    // both as-is and mirrored horizontally.
+    static DecodeTileFn decodeTile;
+
+    // Resolves one line of pixels through a 64-entry table of 16 or 32-bit host colors:
+    //  - bg[i] is a background table index (palette * 4 + color)
+    //  - sprites[i] is 0 for no sprite, otherwise a table index with bit 7 set
+    //    if the sprite is behind background colors 1-3.
+    static ComposeLine16Fn composeLine16;
+    static ComposeLine32Fn composeLine32;
+
+    static void decodeTileScalar(const Byte* tile, Byte* out, Byte* outFlipped);
+
+    template<typename Pixel>
+    static void composeLineScalar(Pixel* out, const Byte* bg, const Byte* sprites, const Pixel* colorTable,
+            unsigned n) {
+        for (unsigned i = 0; i < n; i++) {
+            bool spriteVisible = sprites[i] && (!(sprites[i] & 0x80) || (bg[i] & 0x3) == 0);
+            out[i] = colorTable[spriteVisible ? sprites[i] & 0x7f : bg[i]];
+        }
+    }
+};
@@ -7,3 +7,46 @@ typedef uint16_t Word;
 
 typedef int8_t SByte;
 typedef int16_t SWord;
+
+// SIMD kernels (PixelKernels, Scalers, Resampler, AudioMixer) have a scalar reference
+// version and vector versions: mostly written once with GCC vector extensions, and
+// compiled for 4 lanes with the baseline target and for 8 lanes with X86_TARGET("avx2").
+// The vector helpers are always inlined into those functions, so the ABI of 256-bit
+// arguments is moot, and the kernel sources ignore -Wpsabi. Each kernel is called through
+// a function pointer, set at startup to the fastest version the host CPU supports with
+// selectForCpu().
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD
+#define X86_TARGET(feature) __attribute__((target(feature)))
+#else
+#define X86_TARGET(feature)
+#endif
+
+enum CpuFeature {
+    CpuFeature_Sse2,
+    CpuFeature_Ssse3,
+    CpuFeature_Avx2,
+};
+
+inline bool hasCpuFeature(CpuFeature feature) {
+#ifdef HAVE_X86_SIMD
+    // Static initializers may get here first
+    __builtin_cpu_init();
+    switch (feature) {
+        case CpuFeature_Sse2:
+            return __builtin_cpu_supports("sse2");
+        case CpuFeature_Ssse3:
+            return __builtin_cpu_supports("ssse3");
+        case CpuFeature_Avx2:
+            return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return false;
+}
+
+// Returns version if the host CPU supports feature, otherwise fallback
+template<typename Fn>
+inline Fn selectForCpu(CpuFeature feature, Fn version, Fn fallback) {
+    return hasCpuFeature(feature) ? version : fallback;
+}
@@ -0,0 +1,160 @@
+#include "Resampler.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+static const struct {
+    unsigned taps;
+    unsigned phaseBits;
+    double passband;    // fraction of the output Nyquist frequency left untouched
+    double beta;        // Kaiser window shape, higher means more stopband attenuation
+} qualities[] = {
+        { 8, 6, 0.80, 5 },
+        { 16, 8, 0.88, 7 },
+        { 32, 9, 0.92, 9 },
+};
+
+// Zeroth order modified Bessel function of the first kind, for the Kaiser window
+static double besselI0(double x) {
+    double sum = 1, term = 1;
+    for (unsigned k = 1; term > sum * 1e-12; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+Resampler::Resampler(unsigned inputRate, unsigned outputRate, ResamplerQuality quality) :
+        taps(qualities[quality].taps),
+        phaseBits(qualities[quality].phaseBits),
+        step(((uint64_t)inputRate << 32) / outputRate),
+        position(0) {
+    unsigned phases = 1 << phaseBits;
+    unsigned halfWidth = taps / 2;
+    // When downsampling, the cutoff moves down to the output Nyquist frequency
+    double cutoff = qualities[quality].passband * std::min(1.0, (double)outputRate / inputRate);
+    double beta = qualities[quality].beta;
+
+    kernel.resize(phases * taps);
+    for (unsigned phase = 0; phase < phases; phase++) {
+        float* coeffs = &kernel[phase * taps];
+        double sum = 0;
+        for (unsigned i = 0; i < taps; i++) {
+            double t = i + 1.0 - halfWidth - (double)phase / phases;
+            double x = M_PI * cutoff * t;
+            double sinc = t == 0 ? 1 : std::sin(x) / x;
+            double r = t / halfWidth;
+            double window = besselI0(beta * std::sqrt(std::max(0.0, 1 - r * r))) / besselI0(beta);
+            coeffs[i] = (float)(sinc * window);
+            sum += coeffs[i];
+        }
+        // Unity gain at DC for every phase, or the phase changes would be heard as noise
+        for (unsigned i = 0; i < taps; i++) {
+            coeffs[i] = (float)(coeffs[i] / sum);
+        }
+    }
+
+    clear();
+}
+
+void Resampler::clear() {
+    // Half a kernel of silence, so that the first output sample lines up with the first input sample
+    left.assign(taps / 2 - 1, 0);
+    right.assign(taps / 2 - 1, 0);
+    position = 0;
+}
+
+void Resampler::write(const StereoSample* in, unsigned count) {
+    // Drop the history no output sample needs anymore
+    unsigned consumed = std::min((unsigned)(position >> 32), (unsigned)left.size());
+    if (consumed) {
+        left.erase(left.begin(), left.begin() + consumed);
+        right.erase(right.begin(), right.begin() + consumed);
+        position -= (uint64_t)consumed << 32;
+    }
+
+    size_t size = left.size();
+    left.resize(size + count);
+    right.resize(size + count);
+    for (unsigned i = 0; i < count; i++) {
+        left[size + i] = in[i].left;
+        right[size + i] = in[i].right;
+    }
+}
+
+unsigned Resampler::read(StereoSample* out, unsigned count, DotFn dotFn) {
+    if (!dotFn) {
+        dotFn = dot;
+    }
+
+    unsigned phaseShift = 32 - phaseBits;
+    unsigned phaseMask = (1 << phaseBits) - 1;
+    unsigned produced = 0;
+    for (; produced < count; produced++) {
+        size_t base = (size_t)(position >> 32);
+        if (base + taps > left.size()) {
+            break;
+        }
+
+        unsigned phase = (unsigned)(position >> phaseShift) & phaseMask;
+        float sums[2];
+        dotFn(&kernel[phase * taps], &left[base], &right[base], taps, sums);
+        out[produced].left = (int16_t)clamp((int)std::lrint(sums[0]), -32768, 32767);
+        out[produced].right = (int16_t)clamp((int)std::lrint(sums[1]), -32768, 32767);
+        position += step;
+    }
+    return produced;
+}
+
+void Resampler::dotScalar(const float* kernel, const float* left, const float* right,
+        unsigned taps, float* out) {
+    float sumLeft = 0, sumRight = 0;
+    for (unsigned i = 0; i < taps; i++) {
+        sumLeft += kernel[i] * left[i];
+        sumRight += kernel[i] * right[i];
+    }
+    out[0] = sumLeft;
+    out[1] = sumRight;
+}
+
+template<unsigned N>
+struct FloatVec {
+    typedef float F __attribute__((vector_size(4 * N)));
+};
+
+template<unsigned N>
+static inline __attribute__((always_inline)) void dotVec(const float* kernel, const float* left,
+        const float* right, unsigned taps, float* out) {
+    typedef typename FloatVec<N>::F F;
+
+    F sumLeft = {}, sumRight = {};
+    for (unsigned i = 0; i < taps; i += N) {
+        F k, l, r;
+        std::memcpy(&k, kernel + i, sizeof(k));
+        std::memcpy(&l, left + i, sizeof(l));
+        std::memcpy(&r, right + i, sizeof(r));
+        sumLeft += k * l;
+        sumRight += k * r;
+    }
+
+    out[0] = out[1] = 0;
+    for (unsigned i = 0; i < N; i++) {
+        out[0] += sumLeft[i];
+        out[1] += sumRight[i];
+    }
+}
+
+static void dot4(const float* kernel, const float* left, const float* right, unsigned taps, float* out) {
+    dotVec<4>(kernel, left, right, taps, out);
+}
+
+X86_TARGET("avx2")
+static void dotAvx2(const float* kernel, const float* left, const float* right, unsigned taps, float* out) {
+    dotVec<8>(kernel, left, right, taps, out);
+}
+
+Resampler::DotFn Resampler::dot = selectForCpu<DotFn>(CpuFeature_Avx2, dotAvx2, dot4);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Platform.hpp"
+#include "Sound.hpp"
+
+#include <vector>
+
+enum ResamplerQuality {
+    Resampler_Fast,     // 8 taps, 64 phases
+    Resampler_Medium,   // 16 taps, 256 phases
+    Resampler_Best,     // 32 taps, 512 phases
+};
+
+// Polyphase windowed-sinc resampler for stereo streams, converting the APU output to the
+// rate of the host's sound server. Each output sample is the dot product of the input
+// history with the kernel phase nearest to its fractional position, a SIMD kernel (see
+// Platform.hpp).
+class Resampler {
+public:
+    // Filters taps samples of both channels with the same kernel phase into out[0] and out[1].
+    // taps is always a multiple of 8.
+    typedef void (*DotFn)(const float* kernel, const float* left, const float* right,
+            unsigned taps, float* out);
+
+    static DotFn dot;
+    static void dotScalar(const float* kernel, const float* left, const float* right,
+            unsigned taps, float* out);
+
+    Resampler(unsigned inputRate, unsigned outputRate, ResamplerQuality quality = Resampler_Medium);
+
+    void write(const StereoSample* in, unsigned count);
+    // Reads up to count samples, as many as the input written so far allows
+    unsigned read(StereoSample* out, unsigned count, DotFn dotFn = nullptr);
+    void clear();
+
+    unsigned getTaps() { return taps; }
+
+private:
+    unsigned taps;
+    unsigned phaseBits;
+    uint64_t step;          // input samples per output sample, 32 fraction bits
+    uint64_t position;      // of the next output sample in the history, 32 fraction bits
+    std::vector<float> kernel;  // taps coefficients for each phase
+    std::vector<float> left;
+    std::vector<float> right;
+};
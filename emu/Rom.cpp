@@ -14,14 +14,18 @@ static constexpr Word MapperOffset = 0x0147;
 
 static constexpr size_t MAX_SAVE_RAM_SIZE = 0x10000;
 
-Rom::Rom(Logger* log, const char* fileName) :
+Rom::Rom(Logger* log, const char* fileName, bool persistentSaveRam) :
         log(log),
         fileName(fileName),
         saveRamFd(-1),
         saveRamData((Byte*)MAP_FAILED) {
 
     readRomFile(fileName);
-    setupSaveRam(fileName);
+    if (persistentSaveRam) {
+        setupSaveRam(fileName);
+    } else {
+        setupPrivateSaveRam();
+    }
     setupMapper();
 }
 
@@ -54,6 +58,13 @@ void Rom::setupSaveRam(char const* name) {
     }
 }
 
+void Rom::setupPrivateSaveRam() {
+    saveRamData = (Byte*)mmap(nullptr, MAX_SAVE_RAM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (saveRamData == MAP_FAILED) {
+        throw "Can't allocate save RAM";
+    }
+}
+
 void Rom::setupMapper() {
     std::memset(&mapperRegs, 0, sizeof(mapperRegs));
     mapperRegs.romBankLowBits = 1;
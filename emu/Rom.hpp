@@ -32,10 +32,12 @@ class Rom {
 
     void readRomFile(const char* fileName);
     void setupSaveRam(const char* name);
+    void setupPrivateSaveRam();
     void setupMapper();
 
 public:
-    Rom(Logger* log, const char* fileName);
+    // Without persistentSaveRam, save RAM starts out empty and is never written to disk
+    Rom(Logger* log, const char* fileName, bool persistentSaveRam = true);
     ~Rom();
 
     void cartRomAccess(Word address, Byte* pData, bool isWrite);
@@ -0,0 +1,385 @@
+#include "Scalers.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+// Pixel similarity as in hq2x, compared in YUV space
+static inline bool yuvDiffers(uint32_t p, uint32_t q) {
+    int pr = (p >> 16) & 0xff, pg = (p >> 8) & 0xff, pb = p & 0xff;
+    int qr = (q >> 16) & 0xff, qg = (q >> 8) & 0xff, qb = q & 0xff;
+    int dy = ((pr + pg + pb) >> 2) - ((qr + qg + qb) >> 2);
+    int du = ((pr - pb) >> 2) - ((qr - qb) >> 2);
+    int dv = ((2 * pg - pr - pb) >> 3) - ((2 * qg - qr - qb) >> 3);
+    return std::abs(dy) > 48 || std::abs(du) > 7 || std::abs(dv) > 6;
+}
+
+// (2 * e + x + y) / 4 for each channel
+static inline uint32_t blendCorner(uint32_t e, uint32_t x, uint32_t y) {
+    uint32_t rb = 2 * (e & 0xff00ff) + (x & 0xff00ff) + (y & 0xff00ff);
+    uint32_t g = 2 * (e & 0xff00) + (x & 0xff00) + (y & 0xff00);
+    return ((rb >> 2) & 0xff00ff) | ((g >> 2) & 0xff00);
+}
+
+/*
+ * Neighbourhood of the source pixel E:
+ *      A B C
+ *      D E F
+ *      G H I
+ */
+void Scalers::scale2xRowScalar(const uint32_t* above, const uint32_t* row, const uint32_t* below,
+        unsigned width, uint32_t* const* out) {
+    for (int x = 0; x < (int)width; x++) {
+        uint32_t b = above[x], d = row[x - 1], e = row[x], f = row[x + 1], h = below[x];
+        out[0][2 * x] = d == b && b != f && d != h ? d : e;
+        out[0][2 * x + 1] = b == f && b != d && f != h ? f : e;
+        out[1][2 * x] = d == h && d != b && h != f ? d : e;
+        out[1][2 * x + 1] = h == f && d != h && b != f ? f : e;
+    }
+}
+
+void Scalers::scale3xRowScalar(const uint32_t* above, const uint32_t* row, const uint32_t* below,
+        unsigned width, uint32_t* const* out) {
+    for (int x = 0; x < (int)width; x++) {
+        uint32_t a = above[x - 1], b = above[x], c = above[x + 1];
+        uint32_t d = row[x - 1], e = row[x], f = row[x + 1];
+        uint32_t g = below[x - 1], h = below[x], i = below[x + 1];
+
+        bool db = d == b && b != f && d != h;
+        bool bf = b == f && b != d && f != h;
+        bool dh = d == h && d != b && h != f;
+        bool hf = h == f && d != h && b != f;
+
+        out[0][3 * x] = db ? d : e;
+        out[0][3 * x + 1] = (db && e != c) || (bf && e != a) ? b : e;
+        out[0][3 * x + 2] = bf ? f : e;
+        out[1][3 * x] = (db && e != g) || (dh && e != a) ? d : e;
+        out[1][3 * x + 1] = e;
+        out[1][3 * x + 2] = (bf && e != i) || (hf && e != c) ? f : e;
+        out[2][3 * x] = dh ? d : e;
+        out[2][3 * x + 1] = (dh && e != i) || (hf && e != g) ? h : e;
+        out[2][3 * x + 2] = hf ? f : e;
+    }
+}
+
+// Smooths a corner when both neighbours next to it are alike, but unlike the pixel itself
+void Scalers::hq2xRowScalar(const uint32_t* above, const uint32_t* row, const uint32_t* below,
+        unsigned width, uint32_t* const* out) {
+    for (int x = 0; x < (int)width; x++) {
+        uint32_t b = above[x], d = row[x - 1], e = row[x], f = row[x + 1], h = below[x];
+        bool eb = yuvDiffers(e, b), ed = yuvDiffers(e, d), ef = yuvDiffers(e, f), eh = yuvDiffers(e, h);
+
+        out[0][2 * x] = !yuvDiffers(b, d) && eb && ed ? blendCorner(e, b, d) : e;
+        out[0][2 * x + 1] = !yuvDiffers(b, f) && eb && ef ? blendCorner(e, b, f) : e;
+        out[1][2 * x] = !yuvDiffers(h, d) && eh && ed ? blendCorner(e, h, d) : e;
+        out[1][2 * x + 1] = !yuvDiffers(h, f) && eh && ef ? blendCorner(e, h, f) : e;
+    }
+}
+
+template<unsigned N>
+struct Vec {
+    typedef uint32_t U __attribute__((vector_size(4 * N)));
+    typedef int32_t S __attribute__((vector_size(4 * N)));
+
+    static inline __attribute__((always_inline)) void load(U& v, const uint32_t* p) {
+        std::memcpy(&v, p, sizeof(v));
+    }
+    static inline __attribute__((always_inline)) void store(uint32_t* p, const U& v) {
+        std::memcpy(p, &v, sizeof(v));
+    }
+    static inline __attribute__((always_inline)) void eq(U& mask, const U& a, const U& b) {
+        mask = (U)(a == b);
+    }
+    static inline __attribute__((always_inline)) void select(U& out, const U& mask, const U& a, const U& b) {
+        out = (mask & a) | (~mask & b);
+    }
+
+    static inline __attribute__((always_inline)) void toYuv(const U& p, S* yuv) {
+        S r = (S)((p >> 16) & 0xff), g = (S)((p >> 8) & 0xff), b = (S)(p & 0xff);
+        yuv[0] = (r + g + b) >> 2;
+        yuv[1] = (r - b) >> 2;
+        yuv[2] = (2 * g - r - b) >> 3;
+    }
+    static inline __attribute__((always_inline)) void yuvDiffers(U& mask, const S* p, const S* q) {
+        S dy = p[0] - q[0], du = p[1] - q[1], dv = p[2] - q[2];
+        mask = (U)((dy > 48) | (dy < -48) | (du > 7) | (du < -7) | (dv > 6) | (dv < -6));
+    }
+    static inline __attribute__((always_inline)) void blendCorner(U& out, const U& e, const U& x, const U& y) {
+        U rb = 2 * (e & 0xff00ff) + (x & 0xff00ff) + (y & 0xff00ff);
+        U g = 2 * (e & 0xff00) + (x & 0xff00) + (y & 0xff00);
+        out = ((rb >> 2) & 0xff00ff) | ((g >> 2) & 0xff00);
+    }
+
+    static void interleave2(uint32_t* p, const U& a, const U& b);
+    static void interleave3(uint32_t* p, const U& a, const U& b, const U& c);
+};
+
+template<>
+inline __attribute__((always_inline)) void Vec<4>::interleave2(uint32_t* p, const U& a, const U& b) {
+    store(p, __builtin_shuffle(a, b, (U) { 0, 4, 1, 5 }));
+    store(p + 4, __builtin_shuffle(a, b, (U) { 2, 6, 3, 7 }));
+}
+
+template<>
+inline __attribute__((always_inline)) void Vec<8>::interleave2(uint32_t* p, const U& a, const U& b) {
+    store(p, __builtin_shuffle(a, b, (U) { 0, 8, 1, 9, 2, 10, 3, 11 }));
+    store(p + 8, __builtin_shuffle(a, b, (U) { 4, 12, 5, 13, 6, 14, 7, 15 }));
+}
+
+// Picks a0 b0 c0 a1 b1 c1 ... in two steps, first from a and b, then filling in c
+template<>
+inline __attribute__((always_inline)) void Vec<4>::interleave3(uint32_t* p, const U& a, const U& b, const U& c) {
+    store(p, __builtin_shuffle(__builtin_shuffle(a, b, (U) { 0, 4, 0, 1 }), c, (U) { 0, 1, 4, 3 }));
+    store(p + 4, __builtin_shuffle(__builtin_shuffle(a, b, (U) { 5, 0, 2, 6 }), c, (U) { 0, 5, 2, 3 }));
+    store(p + 8, __builtin_shuffle(__builtin_shuffle(a, b, (U) { 0, 3, 7, 0 }), c, (U) { 6, 1, 2, 7 }));
+}
+
+template<>
+inline __attribute__((always_inline)) void Vec<8>::interleave3(uint32_t* p, const U& a, const U& b, const U& c) {
+    store(p, __builtin_shuffle(__builtin_shuffle(a, b, (U) { 0, 8, 0, 1, 9, 0, 2, 10 }), c,
+            (U) { 0, 1, 8, 3, 4, 9, 6, 7 }));
+    store(p + 8, __builtin_shuffle(__builtin_shuffle(a, b, (U) { 0, 3, 11, 0, 4, 12, 0, 5 }), c,
+            (U) { 10, 1, 2, 11, 4, 5, 12, 7 }));
+    store(p + 16, __builtin_shuffle(__builtin_shuffle(a, b, (U) { 13, 0, 6, 14, 0, 7, 15, 0 }), c,
+            (U) { 0, 13, 2, 3, 14, 5, 6, 15 }));
+}
+
+template<unsigned N>
+static inline __attribute__((always_inline)) void scale2xRowVec(const uint32_t* above, const uint32_t* row,
+        const uint32_t* below, unsigned width, uint32_t* const* out) {
+    typedef Vec<N> V;
+    typedef typename V::U U;
+
+    int x = 0;
+    for (; x + (int)N <= (int)width; x += N) {
+        U b, d, e, f, h;
+        V::load(b, &above[x]);
+        V::load(d, &row[x - 1]);
+        V::load(e, &row[x]);
+        V::load(f, &row[x + 1]);
+        V::load(h, &below[x]);
+
+        U eqDB, eqBF, eqDH, eqHF;
+        V::eq(eqDB, d, b);
+        V::eq(eqBF, b, f);
+        V::eq(eqDH, d, h);
+        V::eq(eqHF, h, f);
+
+        U e0, e1, e2, e3;
+        V::select(e0, eqDB & ~eqBF & ~eqDH, d, e);
+        V::select(e1, eqBF & ~eqDB & ~eqHF, f, e);
+        V::select(e2, eqDH & ~eqDB & ~eqHF, d, e);
+        V::select(e3, eqHF & ~eqDH & ~eqBF, f, e);
+
+        V::interleave2(&out[0][2 * x], e0, e1);
+        V::interleave2(&out[1][2 * x], e2, e3);
+    }
+
+    uint32_t* rest[] = { out[0] + 2 * x, out[1] + 2 * x };
+    Scalers::scale2xRowScalar(above + x, row + x, below + x, width - x, rest);
+}
+
+template<unsigned N>
+static inline __attribute__((always_inline)) void scale3xRowVec(const uint32_t* above, const uint32_t* row,
+        const uint32_t* below, unsigned width, uint32_t* const* out) {
+    typedef Vec<N> V;
+    typedef typename V::U U;
+
+    int x = 0;
+    for (; x + (int)N <= (int)width; x += N) {
+        U a, b, c, d, e, f, g, h, i;
+        V::load(a, &above[x - 1]);
+        V::load(b, &above[x]);
+        V::load(c, &above[x + 1]);
+        V::load(d, &row[x - 1]);
+        V::load(e, &row[x]);
+        V::load(f, &row[x + 1]);
+        V::load(g, &below[x - 1]);
+        V::load(h, &below[x]);
+        V::load(i, &below[x + 1]);
+
+        U eqDB, eqBF, eqDH, eqHF, eqEA, eqEC, eqEG, eqEI;
+        V::eq(eqDB, d, b);
+        V::eq(eqBF, b, f);
+        V::eq(eqDH, d, h);
+        V::eq(eqHF, h, f);
+        V::eq(eqEA, e, a);
+        V::eq(eqEC, e, c);
+        V::eq(eqEG, e, g);
+        V::eq(eqEI, e, i);
+
+        U db = eqDB & ~eqBF & ~eqDH;
+        U bf = eqBF & ~eqDB & ~eqHF;
+        U dh = eqDH & ~eqDB & ~eqHF;
+        U hf = eqHF & ~eqDH & ~eqBF;
+
+        U e0, e1, e2, e3, e5, e6, e7, e8;
+        V::select(e0, db, d, e);
+        V::select(e1, (db & ~eqEC) | (bf & ~eqEA), b, e);
+        V::select(e2, bf, f, e);
+        V::select(e3, (db & ~eqEG) | (dh & ~eqEA), d, e);
+        V::select(e5, (bf & ~eqEI) | (hf & ~eqEC), f, e);
+        V::select(e6, dh, d, e);
+        V::select(e7, (dh & ~eqEI) | (hf & ~eqEG), h, e);
+        V::select(e8, hf, f, e);
+
+        V::interleave3(&out[0][3 * x], e0, e1, e2);
+        V::interleave3(&out[1][3 * x], e3, e, e5);
+        V::interleave3(&out[2][3 * x], e6, e7, e8);
+    }
+
+    uint32_t* rest[] = { out[0] + 3 * x, out[1] + 3 * x, out[2] + 3 * x };
+    Scalers::scale3xRowScalar(above + x, row + x, below + x, width - x, rest);
+}
+
+template<unsigned N>
+static inline __attribute__((always_inline)) void hq2xRowVec(const uint32_t* above, const uint32_t* row,
+        const uint32_t* below, unsigned width, uint32_t* const* out) {
+    typedef Vec<N> V;
+    typedef typename V::U U;
+    typedef typename V::S S;
+
+    int x = 0;
+    for (; x + (int)N <= (int)width; x += N) {
+        U b, d, e, f, h;
+        V::load(b, &above[x]);
+        V::load(d, &row[x - 1]);
+        V::load(e, &row[x]);
+        V::load(f, &row[x + 1]);
+        V::load(h, &below[x]);
+
+        S yuvB[3], yuvD[3], yuvE[3], yuvF[3], yuvH[3];
+        V::toYuv(b, yuvB);
+        V::toYuv(d, yuvD);
+        V::toYuv(e, yuvE);
+        V::toYuv(f, yuvF);
+        V::toYuv(h, yuvH);
+
+        U eb, ed, ef, eh, bd, bf, hd, hf;
+        V::yuvDiffers(eb, yuvE, yuvB);
+        V::yuvDiffers(ed, yuvE, yuvD);
+        V::yuvDiffers(ef, yuvE, yuvF);
+        V::yuvDiffers(eh, yuvE, yuvH);
+        V::yuvDiffers(bd, yuvB, yuvD);
+        V::yuvDiffers(bf, yuvB, yuvF);
+        V::yuvDiffers(hd, yuvH, yuvD);
+        V::yuvDiffers(hf, yuvH, yuvF);
+
+        U blended, e0, e1, e2, e3;
+        V::blendCorner(blended, e, b, d);
+        V::select(e0, ~bd & eb & ed, blended, e);
+        V::blendCorner(blended, e, b, f);
+        V::select(e1, ~bf & eb & ef, blended, e);
+        V::blendCorner(blended, e, h, d);
+        V::select(e2, ~hd & eh & ed, blended, e);
+        V::blendCorner(blended, e, h, f);
+        V::select(e3, ~hf & eh & ef, blended, e);
+
+        V::interleave2(&out[0][2 * x], e0, e1);
+        V::interleave2(&out[1][2 * x], e2, e3);
+    }
+
+    uint32_t* rest[] = { out[0] + 2 * x, out[1] + 2 * x };
+    Scalers::hq2xRowScalar(above + x, row + x, below + x, width - x, rest);
+}
+
+static void scale2xRow4(const uint32_t* above, const uint32_t* row, const uint32_t* below,
+        unsigned width, uint32_t* const* out) {
+    scale2xRowVec<4>(above, row, below, width, out);
+}
+
+static void scale3xRow4(const uint32_t* above, const uint32_t* row, const uint32_t* below,
+        unsigned width, uint32_t* const* out) {
+    scale3xRowVec<4>(above, row, below, width, out);
+}
+
+static void hq2xRow4(const uint32_t* above, const uint32_t* row, const uint32_t* below,
+        unsigned width, uint32_t* const* out) {
+    hq2xRowVec<4>(above, row, below, width, out);
+}
+
+X86_TARGET("avx2")
+static void scale2xRowAvx2(const uint32_t* above, const uint32_t* row, const uint32_t* below,
+        unsigned width, uint32_t* const* out) {
+    scale2xRowVec<8>(above, row, below, width, out);
+}
+
+X86_TARGET("avx2")
+static void scale3xRowAvx2(const uint32_t* above, const uint32_t* row, const uint32_t* below,
+        unsigned width, uint32_t* const* out) {
+    scale3xRowVec<8>(above, row, below, width, out);
+}
+
+X86_TARGET("avx2")
+static void hq2xRowAvx2(const uint32_t* above, const uint32_t* row, const uint32_t* below,
+        unsigned width, uint32_t* const* out) {
+    hq2xRowVec<8>(above, row, below, width, out);
+}
+
+Scalers::RowFn Scalers::scale2xRow = selectForCpu<RowFn>(CpuFeature_Avx2, scale2xRowAvx2, scale2xRow4);
+Scalers::RowFn Scalers::scale3xRow = selectForCpu<RowFn>(CpuFeature_Avx2, scale3xRowAvx2, scale3xRow4);
+Scalers::RowFn Scalers::hq2xRow = selectForCpu<RowFn>(CpuFeature_Avx2, hq2xRowAvx2, hq2xRow4);
+
+unsigned Scalers::getScaleFactor(ScalerType type) {
+    switch (type) {
+        case Scaler_Scale2x:
+        case Scaler_Hq2x:
+            return 2;
+        case Scaler_Scale3x:
+            return 3;
+        default:
+            return 1;
+    }
+}
+
+Scalers::RowFn Scalers::getRowFn(ScalerType type) {
+    switch (type) {
+        case Scaler_Scale2x:
+            return scale2xRow;
+        case Scaler_Scale3x:
+            return scale3xRow;
+        case Scaler_Hq2x:
+            return hq2xRow;
+        default:
+            return nullptr;
+    }
+}
+
+void Scalers::scale(ScalerType type, const uint32_t* src, unsigned width, unsigned height,
+        uint32_t* dst, unsigned fromRow, unsigned toRow, RowFn rowFn) {
+    unsigned factor = getScaleFactor(type);
+    if (!rowFn) {
+        rowFn = getRowFn(type);
+    }
+    if (!rowFn) {
+        for (unsigned y = fromRow; y < toRow; y++) {
+            std::memcpy(&dst[y * width], &src[y * width], width * sizeof(uint32_t));
+        }
+        return;
+    }
+
+    // Source rows with the edge pixels repeated on both sides
+    std::vector<uint32_t> padded(3 * (width + 2));
+    auto padRow = [&](unsigned slot, unsigned y) {
+        uint32_t* p = &padded[slot * (width + 2)];
+        std::memcpy(p + 1, &src[y * width], width * sizeof(uint32_t));
+        p[0] = p[1];
+        p[width + 1] = p[width];
+        return p + 1;
+    };
+
+    for (unsigned y = fromRow; y < toRow; y++) {
+        const uint32_t* above = padRow(0, y > 0 ? y - 1 : 0);
+        const uint32_t* row = padRow(1, y);
+        const uint32_t* below = padRow(2, std::min(y + 1, height - 1));
+
+        uint32_t* out[3];
+        for (unsigned k = 0; k < factor; k++) {
+            out[k] = &dst[(y * factor + k) * width * factor];
+        }
+        rowFn(above, row, below, width, out);
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Platform.hpp"
+
+enum ScalerType {
+    Scaler_None,
+    Scaler_Scale2x,     // AdvMAME2x edge-directed pixel art scaler
+    Scaler_Scale3x,
+    Scaler_Hq2x,        // reduced hq2x: YUV threshold edge detection with corner interpolation
+};
+
+// CPU upscaling filters for XRGB8888 frames. The row filters are SIMD kernels (see Platform.hpp).
+struct Scalers {
+    // Scales one row. above, row and below point at source rows that are readable
+    // one pixel beyond both ends; out holds one destination row per scale factor.
+    typedef void (*RowFn)(const uint32_t* above, const uint32_t* row, const uint32_t* below,
+            unsigned width, uint32_t* const* out);
+
+    static RowFn scale2xRow;
+    static RowFn scale3xRow;
+    static RowFn hq2xRow;
+
+    static void scale2xRowScalar(const uint32_t* above, const uint32_t* row, const uint32_t* below,
+            unsigned width, uint32_t* const* out);
+    static void scale3xRowScalar(const uint32_t* above, const uint32_t* row, const uint32_t* below,
+            unsigned width, uint32_t* const* out);
+    static void hq2xRowScalar(const uint32_t* above, const uint32_t* row, const uint32_t* below,
+            unsigned width, uint32_t* const* out);
+
+    static unsigned getScaleFactor(ScalerType type);
+    static RowFn getRowFn(ScalerType type);
+
+    // Scales source rows [fromRow, toRow) of a tightly packed width x height frame into dst,
+    // which is (width * factor) x (height * factor). Edge pixels are repeated.
+    static void scale(ScalerType type, const uint32_t* src, unsigned width, unsigned height,
+            uint32_t* dst, unsigned fromRow, unsigned toRow, RowFn rowFn = nullptr);
+};
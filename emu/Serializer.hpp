@@ -29,6 +29,9 @@ public:
         handleByteBuffer(key, (char*)&obj, sizeof(T));
     }
 
+    // Whether state is being restored, rather than saved
+    bool isLoading() { return type == ReadWrite::Read; }
+
     void beginSave();
     void endSave();
     void saveToFile(std::string filename);
@@ -1,41 +1,26 @@
 #include <string.h>
-#include <QDebug>
 #include "Sound.hpp"
+#include "AudioMixer.hpp"
 #include "Utils.hpp"
 #include "Serializer.hpp"
 
-#include <bitset>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
 
-static constexpr int MaxChanLevel = 0x2000;
-static std::bitset<(1 << 15) - 1> lfsr15Table;
-static std::bitset<(1 << 7) - 1> lfsr7Table;
+static const unsigned long NoEvent = std::numeric_limits<unsigned long>::max();
 
-static bool stepLfsr(uint32_t& st, bool small) {
-    bool out = !(st & 1);
-    uint32_t xorOut = ((st & 1) ^ (st >> 1)) & 1;
-    st >>= 1;
-    st |= xorOut << 14;
+// Output level of a square or noise channel at each envelope volume, out of 0x2000
+static const int volumeLevels[] = {
+        0, 546, 1092, 1638,
+        2185, 2731, 3277, 3823,
+        4369, 4915, 5461, 6007,
+        6554, 7100, 7646, 8192,
+};
 
-    if (small) {
-        st &= ~(1 << 6);
-        st |= xorOut << 6;
-    }
-
-    return out;
-}
-
-static struct InitLfsrTables {
-    InitLfsrTables() {
-        uint32_t st15 = (1 << 15) - 1;
-        uint32_t st7 = (1 << 15) - 1;
-        for (unsigned i = 0; i < bit(15); ++i) {
-            lfsr15Table[i] = stepLfsr(st15, false);
-            if (i < bit(7)) {
-                lfsr7Table[i] = stepLfsr(st7, true);
-            }
-        }
-    }
-} _initLfsrTables;
+// Number of high steps out of the 8 of each duty cycle
+static const unsigned dutyHighSteps[] = { 1, 2, 4, 6 };
 
 void Sound::registerAccess(Word address, Byte* pData, bool isWrite) {
     if (address == 0xff15 || address == 0xff1f ||
@@ -44,198 +29,532 @@ void Sound::registerAccess(Word address, Byte* pData, bool isWrite) {
         return;
     }
 
-    // TODO: mask
-    Byte reg = address - 0xff10;
-    // qDebug() << "Register write: " << reg;
-    BusUtil::arrayMemAccess((Byte*)&regs, reg, pData, isWrite);
+    catchUp();
 
-    if (!isWrite || (*pData & 0x80) == 0) {
+    Byte reg = address & 0xff;
+    bool powered = regs.ctrl.stat & 0x80;
+    if (reg == Snd_Ctrl_Stat) {
+        if (isWrite) {
+            if (powered && !(*pData & 0x80)) {
+                powerOff();
+            } else if (!powered && (*pData & 0x80)) {
+                sequencerStep = 0;
+            }
+            regs.ctrl.stat = *pData & 0x80;
+            updateLevels();
+            updateOutput();
+            updateNextEvent();
+            updateMix();
+        } else {
+            *pData = regs.ctrl.stat | 0x70;
+            for (unsigned i = 0; i < 4; i++) {
+                *pData |= channels[i].enabled << i;
+            }
+        }
         return;
     }
 
-    switch (address & 0xff) {
-        case Snd_Ch1_FreqHi:
-            // case Snd_Ch1_Envelope:
-            restartTimer(timers.ch1);
-            break;
+    // TODO: mask
+    if (isWrite && !powered && reg < Snd_Ch3_WaveRam) {
+        return;
+    }
+    BusUtil::arrayMemAccess((Byte*)&regs, address - 0xff10, pData, isWrite);
+    if (!isWrite) {
+        return;
+    }
 
-        case Snd_Ch2_FreqHi:
-            // case Snd_Ch2_Envelope:
-            restartTimer(timers.ch2);
+    switch (reg) {
+        case Snd_Ch1_Wave:
+            channels[0].lengthCounter = 64 - regs.ch1.square.soundLength;
+            break;
+        case Snd_Ch2_Wave:
+            channels[1].lengthCounter = 64 - regs.ch2.square.soundLength;
+            break;
+        case Snd_Ch3_Length:
+            channels[2].lengthCounter = 256 - regs.ch3.length;
+            break;
+        case Snd_Ch4_Length:
+            channels[3].lengthCounter = 64 - (regs.ch4.length & 0x3f);
             break;
 
-        case Snd_Ch3_FreqHi:
-            restartTimer(timers.ch3);
+        case Snd_Ch1_Envelope:
+        case Snd_Ch2_Envelope:
+        case Snd_Ch3_Enable:
+        case Snd_Ch4_Envelope: {
+            unsigned channel = reg == Snd_Ch1_Envelope ? 0 : reg == Snd_Ch2_Envelope ? 1 :
+                    reg == Snd_Ch3_Enable ? 2 : 3;
+            if (!isDacEnabled(channel)) {
+                channels[channel].enabled = false;
+            }
             break;
+        }
 
+        case Snd_Ch1_FreqHi:
+        case Snd_Ch2_FreqHi:
+        case Snd_Ch3_FreqHi:
         case Snd_Ch4_Control:
-            restartTimer(timers.ch4);
+            if (*pData & 0x80) {
+                trigger(reg == Snd_Ch1_FreqHi ? 0 : reg == Snd_Ch2_FreqHi ? 1 : reg == Snd_Ch3_FreqHi ? 2 : 3);
+            }
             break;
     }
+
+    // Any write may change the output of any channel, or the mix
+    updateLevels();
+    updateOutput();
+    updateNextEvent();
+    updateMix();
+}
+
+void Sound::powerOff() {
+    std::memset(&regs, 0, offsetof(SoundRegs, waveRam));
+    for (ChannelState& channel : channels) {
+        channel.enabled = false;
+    }
+    sweep.enabled = false;
 }
 
-void Sound::tick(int cycleDelta) {
-    currentCycle += cycleDelta;
-    cycleResidue += 375 * cycleDelta;
+void Sound::trigger(unsigned channel) {
+    ChannelState& ch = channels[channel];
+    ch.enabled = isDacEnabled(channel);
+    if (!ch.lengthCounter) {
+        ch.lengthCounter = channel == 2 ? 256 : 64;
+    }
+    ch.nextStepCycle = currentCycle + getPeriod(channel);
+
+    if (channel == 2) {
+        ch.position = 0;
+    } else {
+        EnvelopeRegs& envelope = getEnvelope(channel);
+        ch.volume = envelope.initialVolume;
+        ch.envelopeTimer = envelope.sweep ? envelope.sweep : 8;
+    }
 
-    tickTimer(timers.ch1, regs.ch1.square.soundLength, 64, regs.ch1.square.freqCtrl.noRestart);
-    tickTimer(timers.ch2, regs.ch2.square.soundLength, 64, regs.ch2.square.freqCtrl.noRestart);
-    tickTimer(timers.ch3, regs.ch3.length, 256, regs.ch3.freqCtrl.noRestart);
-    tickTimer(timers.ch4, regs.ch4.length, 64, regs.ch4.noRestart);
+    if (channel == 0) {
+        sweep.shadowFrequency = regs.ch1.square.freqCtrl.getFrequency();
+        sweep.timer = regs.ch1.sweepTime ? regs.ch1.sweepTime : 8;
+        sweep.enabled = regs.ch1.sweepTime || regs.ch1.sweepShift;
+        if (regs.ch1.sweepShift) {
+            sweepFrequency();
+        }
+    } else if (channel == 3) {
+        lfsr = 0x7fff;
+    }
+}
 
-    if (cycleResidue >= 32768) {
-        cycleResidue -= 32768;
-        currentSampleNumber++;
+// Cycles between two steps of the channel waveform: duty steps, wave samples or LFSR shifts
+unsigned Sound::getPeriod(unsigned channel) {
+    switch (channel) {
+        case 0:
+            return (2048 - regs.ch1.square.freqCtrl.getFrequency()) * 4;
+        case 1:
+            return (2048 - regs.ch2.square.freqCtrl.getFrequency()) * 4;
+        case 2:
+            return (2048 - regs.ch3.freqCtrl.getFrequency()) * 2;
+        default:
+            return (regs.ch4.polyDivider ? 16 * regs.ch4.polyDivider : 8) << regs.ch4.frequency;
+    }
+}
 
-        generateSamples();
+bool Sound::isDacEnabled(unsigned channel) {
+    if (channel == 2) {
+        return regs.ch3.enable & 0x80;
     }
+    return getEnvelope(channel).bits & 0xf8;
 }
 
-void Sound::generateSamples() {
-    int sounds[] = {
-            evalPulseChannel(regs.ch1.square, timers.ch1),
-            evalPulseChannel(regs.ch2.square, timers.ch2),
-            evalWaveChannel(),
-            evalNoiseChannel(),
-    };
+bool Sound::isLengthEnabled(unsigned channel) {
+    switch (channel) {
+        case 0:
+            return regs.ch1.square.freqCtrl.lengthEnabled;
+        case 1:
+            return regs.ch2.square.freqCtrl.lengthEnabled;
+        case 2:
+            return regs.ch3.freqCtrl.lengthEnabled;
+        default:
+            return regs.ch4.lengthEnabled;
+    }
+}
+
+EnvelopeRegs& Sound::getEnvelope(unsigned channel) {
+    return channel == 0 ? regs.ch1.square.envelope : channel == 1 ? regs.ch2.square.envelope : regs.ch4.envelope;
+}
+
+void Sound::runUntil(unsigned long cycle) {
+    if (!synthesis) {
+        // Only the frame sequencer changes anything that can be read back
+        while (nextSequencerCycle <= cycle) {
+            currentCycle = nextSequencerCycle;
+            stepSequencer();
+        }
+        currentCycle = cycle;
+        return;
+    }
 
-    int leftDac = 0, rightDac = 0;
-    for (int i = 0; i < 4; ++i) {
-        if (regs.ctrl.chSel & bit(i)) {
-            leftDac += sounds[i];
+    while (nextEventCycle <= cycle) {
+        currentCycle = nextEventCycle;
+        if (currentCycle - frameStartCycle >= MaxFrameCycles) {
+            endBlipFrame();
         }
-        if (regs.ctrl.chSel & bit(i + 4)) {
-            rightDac += sounds[i];
+        if (currentCycle == nextSequencerCycle) {
+            stepSequencer();
         }
+        for (unsigned i = 0; i < 4; i++) {
+            if (channels[i].enabled && channels[i].nextStepCycle == currentCycle) {
+                stepChannel(i);
+            }
+        }
+        updateOutput();
+        updateNextEvent();
+    }
+    currentCycle = cycle;
+}
+
+// The frequency timer of a channel expired: advance its waveform by one step. A new
+// frequency only takes effect from here on, as on hardware.
+void Sound::stepChannel(unsigned channel) {
+    ChannelState& ch = channels[channel];
+    ch.nextStepCycle += getPeriod(channel);
+
+    if (channel == 2) {
+        ch.position = (ch.position + 1) % 32;
+    } else if (channel == 3) {
+        unsigned feedback = (lfsr ^ (lfsr >> 1)) & 1;
+        lfsr = (lfsr >> 1) | (feedback << 14);
+        if (regs.ch4.counterShort) {
+            lfsr = (lfsr & ~(1 << 6)) | (feedback << 6);
+        }
+    } else {
+        ch.position = (ch.position + 1) % 8;
+    }
+    channelLevels[channel] = getChannelLevel(channel);
+}
+
+// Length counters are clocked at steps 0, 2, 4 and 6, the sweep at 2 and 6, envelopes at 7
+void Sound::stepSequencer() {
+    if (sequencerStep % 2 == 0) {
+        for (unsigned i = 0; i < 4; i++) {
+            clockLength(i);
+        }
+    }
+    if (sequencerStep == 2 || sequencerStep == 6) {
+        clockSweep();
     }
+    if (sequencerStep == 7) {
+        clockEnvelope(0);
+        clockEnvelope(1);
+        clockEnvelope(3);
+    }
+
+    sequencerStep = (sequencerStep + 1) % 8;
+    nextSequencerCycle += SequencerCycles;
+    updateLevels();
+}
 
-    leftSample = leftDac * (regs.ctrl.leftVolume + 1) / 16;
-    rightSample = rightDac * (regs.ctrl.rightVolume + 1) / 16;
+void Sound::clockLength(unsigned channel) {
+    ChannelState& ch = channels[channel];
+    if (isLengthEnabled(channel) && ch.lengthCounter && !--ch.lengthCounter) {
+        ch.enabled = false;
+    }
 }
 
-int Sound::evalWaveChannel() {
-    static const unsigned shiftLookup[] = { 4, 0, 1, 2 };
-    static const int sampleLookup[] = {
+void Sound::clockEnvelope(unsigned channel) {
+    ChannelState& ch = channels[channel];
+    EnvelopeRegs& envelope = getEnvelope(channel);
+    if (!envelope.sweep || !ch.envelopeTimer || --ch.envelopeTimer) {
+        return;
+    }
+
+    ch.envelopeTimer = envelope.sweep;
+    if (envelope.increase && ch.volume < 15) {
+        ch.volume++;
+    } else if (!envelope.increase && ch.volume > 0) {
+        ch.volume--;
+    }
+}
+
+void Sound::clockSweep() {
+    if (!sweep.timer || --sweep.timer) {
+        return;
+    }
+
+    sweep.timer = regs.ch1.sweepTime ? regs.ch1.sweepTime : 8;
+    if (!sweep.enabled || !regs.ch1.sweepTime) {
+        return;
+    }
+    unsigned frequency = sweepFrequency();
+    if (frequency < 2048 && regs.ch1.sweepShift) {
+        sweep.shadowFrequency = frequency;
+        regs.ch1.square.freqCtrl.low = frequency & 0xff;
+        regs.ch1.square.freqCtrl.high = frequency >> 8;
+        // Checked again for overflow with the new frequency
+        sweepFrequency();
+    }
+}
+
+// Computes the next frequency of the sweep, and turns channel 1 off if it overflows
+unsigned Sound::sweepFrequency() {
+    unsigned delta = sweep.shadowFrequency >> regs.ch1.sweepShift;
+    unsigned frequency = regs.ch1.sweepDecrease ? sweep.shadowFrequency - delta : sweep.shadowFrequency + delta;
+    if (frequency >= 2048) {
+        channels[0].enabled = false;
+    }
+    return frequency;
+}
+
+int Sound::getChannelLevel(unsigned channel) {
+    static const unsigned waveShifts[] = { 4, 0, 1, 2 };
+    static const int waveLevels[] = {
             -8192, -7100, -6007, -4915,
             -3823, -2731, -1638, -546,
             546, 1638, 2731, 3823,
             4915, 6007, 7100, 8192,
     };
 
-    if (!timers.ch3.lengthTimerRunning() || !regs.ch3.enable) {
+    const ChannelState& ch = channels[channel];
+    if (!ch.enabled) {
         return 0;
     }
 
-    // TODO: make some sense of this code
-    unsigned period = (2048 - regs.ch3.freqCtrl.getFrequency());
-    unsigned long cycleDelta = currentCycle - timers.ch3.frequencyCounterStartCycle;
-    unsigned cycleInWave = cycleDelta % (period * 32 * 2);
-    unsigned pointer = ((cycleInWave / period) / 2 + 1) % 32;
-
-#if 0
-    char buf[100] = "";
-    char buf2[8];
-    for (unsigned i = 0; i < 16; ++i) {
-        sprintf(buf2, "%x %x ", regs.waveRam[i] >> 4, regs.waveRam[i] & 0xf);
-        strcat(buf, buf2);
+    switch (channel) {
+        case 0:
+            return ch.position < dutyHighSteps[regs.ch1.square.waveDuty] ? volumeLevels[ch.volume] :
+                    -volumeLevels[ch.volume];
+        case 1:
+            return ch.position < dutyHighSteps[regs.ch2.square.waveDuty] ? volumeLevels[ch.volume] :
+                    -volumeLevels[ch.volume];
+        case 2: {
+            unsigned sample = (regs.waveRam[ch.position / 2] >> (ch.position & 1 ? 0 : 4)) & 0xf;
+            return waveLevels[sample >> waveShifts[regs.ch3.volume]];
+        }
+        default:
+            return lfsr & 1 ? -volumeLevels[ch.volume] : volumeLevels[ch.volume];
     }
-    log->warn("Wave pointer %02d: %s", pointer, buf);
-#endif
-
-    unsigned sample = (regs.waveRam[pointer >> 1] >> (pointer & 1 ? 0 : 4)) & 0xf;
-    sample >>= shiftLookup[regs.ch3.volume];
-    // qDebug() << "Wave sample: " << sample << " at pointer: " << ((cycleInWave / period) / 2 + 1);
+}
 
-    return sampleLookup[sample];
+void Sound::updateLevels() {
+    if (!synthesis) {
+        return;
+    }
+    for (unsigned i = 0; i < 4; i++) {
+        channelLevels[i] = getChannelLevel(i);
+    }
 }
 
-int Sound::evalPulseChannel(SquareChannelRegs& regs, TimerState& timerState) {
-    if (!timerState.lengthTimerRunning()) {
-        return 0;
+void Sound::updateNextEvent() {
+    nextEventCycle = std::min(nextSequencerCycle, frameStartCycle + MaxFrameCycles);
+    if (!synthesis) {
+        return;
+    }
+    for (unsigned i = 0; i < 4; i++) {
+        if (channels[i].enabled) {
+            nextEventCycle = std::min(nextEventCycle, channels[i].nextStepCycle);
+        }
     }
+}
 
-    bool pulseOn = evalPulseWaveform(regs);
-    unsigned pulseVolume = evalEnvelope(regs.envelope, timerState);
-    // qDebug() << "Envel result: " << pulseVolume;
-    return mixVolume(pulseOn ? MaxChanLevel : -MaxChanLevel, pulseVolume);
+void Sound::updateOutput() {
+    if (!synthesis) {
+        return;
+    }
+    for (unsigned i = 0; i < 4; i++) {
+        if (channelLevels[i] != bufferLevels[i]) {
+            channelBuffers[i].addDelta(currentCycle - frameStartCycle, channelLevels[i] - bufferLevels[i]);
+            bufferLevels[i] = channelLevels[i];
+        }
+    }
 }
 
-// Returns true/false whether the square channel output is high or low
-bool Sound::evalPulseWaveform(SquareChannelRegs& ch) {
-    static const unsigned pulseWidthLookup[] = { 4 * 1, 4 * 2, 4 * 4, 4 * 6 };
+// Queues NR50/NR51 changes, to be applied when reading reaches the current cycle
+void Sound::updateMix() {
+    if (!synthesis) {
+        return;
+    }
+    Byte volume = regs.ctrl.volume, chSel = regs.ctrl.chSel;
+    MixChange* last = mixChanges.empty() ? nullptr : &mixChanges.back();
+    if (last ? last->volume == volume && last->chSel == chSel : mixVolume == volume && mixChSel == chSel) {
+        return;
+    }
 
-    unsigned pulseLen = 2048 - ch.freqCtrl.getFrequency();
-    unsigned long stepInPulse = currentCycle % (pulseLen * 4 * 8);
+    MixChange change = { channelBuffers[0].getSampleIndex(currentCycle - frameStartCycle), volume, chSel };
+    if (last && last->position == change.position) {
+        *last = change;
+    } else {
+        mixChanges.push_back(change);
+    }
+}
 
-    return stepInPulse / pulseLen < pulseWidthLookup[ch.waveDuty];
+// Moves the mix along by count samples read or dropped
+void Sound::advanceMix(unsigned count) {
+    unsigned applied = 0;
+    while (applied < mixChanges.size() && mixChanges[applied].position <= count) {
+        mixVolume = mixChanges[applied].volume;
+        mixChSel = mixChanges[applied].chSel;
+        applied++;
+    }
+    mixChanges.erase(mixChanges.begin(), mixChanges.begin() + applied);
+    for (MixChange& change : mixChanges) {
+        change.position -= count;
+    }
 }
 
-int Sound::evalNoiseChannel() {
-    if (!timers.ch4.lengthTimerRunning() || !regs.ch4.start) {
-        return 0;
+// Channel levels are scaled by NR50 volume + 1 out of 16 when panned to a side
+void Sound::getMixGains(int32_t* leftGains, int32_t* rightGains) {
+    unsigned leftVolume = (mixVolume & 7) + 1;
+    unsigned rightVolume = ((mixVolume >> 4) & 7) + 1;
+    for (unsigned i = 0; i < 4; i++) {
+        double gain = channelMuted[i] ? 0 : channelGains[i] * (1 << (AudioMixer::GainBits - 4));
+        leftGains[i] = mixChSel & bit(i) ? (int32_t)std::lround(leftVolume * gain) : 0;
+        rightGains[i] = mixChSel & bit(i + 4) ? (int32_t)std::lround(rightVolume * gain) : 0;
     }
-    unsigned pulseLength = regs.ch4.polyDivider ? 16 * regs.ch4.polyDivider : 8;
-    pulseLength *= bit(regs.ch4.frequency + 1) / 2; // TODO: why /2?
-    unsigned lfsrWidth = regs.ch4.counterShort ? bit(7) - 1 : bit(15) - 1;
+}
 
-    unsigned long cycleDelta = currentCycle - timers.ch4.frequencyCounterStartCycle;
-    unsigned long stepInPulse = (cycleDelta / pulseLength) % lfsrWidth;
-    bool pulse = regs.ch4.counterShort ? lfsr7Table[stepInPulse] : lfsr15Table[stepInPulse];
+void Sound::setChannelGain(unsigned channel, double gain) {
+    channelGains[channel] = clamp(gain, 0.0, 4.0);
+}
 
-    unsigned volume = evalEnvelope(regs.ch4.envelope, timers.ch4);
-    return mixVolume(pulse ? MaxChanLevel : -MaxChanLevel, volume);
+void Sound::endBlipFrame() {
+    if (synthesis) {
+        unsigned dropped = 0;
+        for (BlipBuffer& buffer : channelBuffers) {
+            dropped = buffer.endFrame(currentCycle - frameStartCycle);
+            buffer.setRates(ClockRate, SampleRate * rateAdjustment);
+        }
+        advanceMix(dropped);
+    }
+    frameStartCycle = currentCycle;
 }
 
-void Sound::tickTimer(TimerState& state, Byte curLength, int channelMaxLength, bool noRestart) {
-    long cycleDelta = currentCycle - state.lengthCounterStartCycle;
+void Sound::endFrame() {
+    catchUp();
+    endBlipFrame();
 
-    if (noRestart && cycleDelta >> 16 > (channelMaxLength - curLength)) {
-        state.lengthCounterStartCycle = 0;
+    if (requestedSynthesis != synthesis) {
+        synthesis = requestedSynthesis;
+        if (synthesis) {
+            restartOutput();
+        }
     }
+    updateNextEvent();
 }
 
-void Sound::restartTimer(TimerState& state) {
-    // qDebug() << "Restart envelope at cycle " << currentCycle;
-    state.lengthCounterStartCycle = currentCycle;
-    state.frequencyCounterStartCycle = currentCycle;
+// Output restarts from silence at the current cycle, fading in to avoid a click
+void Sound::restartOutput() {
+    // Channel timers stand still without synthesis, and their phase is lost anyway
+    for (unsigned i = 0; i < 4; i++) {
+        if (channels[i].nextStepCycle <= currentCycle) {
+            channels[i].nextStepCycle = currentCycle + getPeriod(i);
+        }
+    }
+    for (unsigned i = 0; i < 4; i++) {
+        channelBuffers[i].clear();
+        bufferLevels[i] = 0;
+    }
+    frameStartCycle = currentCycle;
+    mixVolume = regs.ctrl.volume;
+    mixChSel = regs.ctrl.chSel;
+    mixChanges.clear();
+    fadeInRemaining = FadeInSamples;
+
+    updateLevels();
+    updateOutput();
+    updateNextEvent();
 }
 
-unsigned int Sound::evalEnvelope(EnvelopeRegs& regs, TimerState& state) {
-    if (regs.sweep == 0) {
-        return regs.initialVolume;
+void Sound::applyFadeIn(StereoSample* samples, unsigned count) {
+    for (unsigned i = 0; i < count && fadeInRemaining; i++, fadeInRemaining--) {
+        int scale = FadeInSamples - fadeInRemaining;
+        samples[i].left = (int16_t)(samples[i].left * scale / FadeInSamples);
+        samples[i].right = (int16_t)(samples[i].right * scale / FadeInSamples);
     }
-
-    long steps = (currentCycle - state.lengthCounterStartCycle) / ((1 << 16) * regs.sweep);
-    // qDebug() << "Envelope steps: " << steps << " at cycle " << currentCycle;
-    return clamp(regs.initialVolume + (regs.increase ? steps : -steps), 0, 0xf);
 }
 
-int Sound::mixVolume(int sample, unsigned int volume) {
-    static const int lookup[] = {
-            0, 546, 1092, 1638,
-            2185, 2731, 3277, 3823,
-            4369, 4915, 5461, 6007,
-            6554, 7100, 7646, 8192,
-    };
-    return (long(lookup[volume]) * sample) / 8192;
+unsigned Sound::readSamples(StereoSample* out, unsigned count, int16_t* const* stems) {
+    count = std::min(count, samplesAvailable());
+    advanceMix(0);
+    for (unsigned done = 0; done < count;) {
+        // Blocks end where the mix changes
+        unsigned blockSize = std::min(count - done, (unsigned)MixBlockSamples);
+        if (!mixChanges.empty()) {
+            blockSize = std::min(blockSize, mixChanges.front().position);
+        }
+
+        int16_t blocks[4][MixBlockSamples];
+        const int16_t* blockChannels[4];
+        for (unsigned i = 0; i < 4; i++) {
+            channelBuffers[i].readSamples(blocks[i], blockSize, 1);
+            blockChannels[i] = blocks[i];
+            if (stems) {
+                std::copy(blocks[i], blocks[i] + blockSize, stems[i] + done);
+            }
+        }
+        int32_t leftGains[4], rightGains[4];
+        getMixGains(leftGains, rightGains);
+        AudioMixer::mix(blockChannels, leftGains, rightGains, blockSize, out + done);
+        if (fadeInRemaining) {
+            applyFadeIn(out + done, blockSize);
+        }
+
+        done += blockSize;
+        advanceMix(blockSize);
+    }
+
+    if (sampleHashing) {
+        sampleHash = hashBytes(out, count * sizeof(StereoSample), sampleHash);
+    }
+    return count;
 }
 
-Sound::Sound(Logger* log) : log(log),
+Sound::Sound(Logger* log, const long* clock) : log(log),
+                            clock(clock),
                             currentCycle(),
-                            cycleResidue(),
-                            currentSampleNumber(),
-                            leftSample(),
-                            rightSample() {
+                            lfsr(0x7fff),
+                            sequencerStep(),
+                            nextSequencerCycle(SequencerCycles),
+                            nextEventCycle(),
+                            channelBuffers{ { ClockRate, SampleRate, BufferSamples },
+                                    { ClockRate, SampleRate, BufferSamples },
+                                    { ClockRate, SampleRate, BufferSamples },
+                                    { ClockRate, SampleRate, BufferSamples } },
+                            bufferLevels(),
+                            frameStartCycle(),
+                            rateAdjustment(1),
+                            mixVolume(),
+                            mixChSel(),
+                            synthesis(true),
+                            requestedSynthesis(true),
+                            fadeInRemaining(0),
+                            sampleHashing(false),
+                            sampleHash(0) {
     memset(&regs, 0, sizeof(regs));
-    memset(&timers, 0, sizeof(timers));
+    memset(&channels, 0, sizeof(channels));
+    memset(&sweep, 0, sizeof(sweep));
+    for (unsigned i = 0; i < 4; i++) {
+        channelGains[i] = 1;
+        channelMuted[i] = false;
+    }
+    updateLevels();
+    updateNextEvent();
 }
 
 void Sound::serialize(Serializer& ser) {
     ser.handleObject("Sound.currentCycle", currentCycle);
-    ser.handleObject("Sound.cycleResidue", cycleResidue);
-    ser.handleObject("Sound.currentSampleNumber", currentSampleNumber);
-    ser.handleObject("Sound.leftSample", leftSample);
-    ser.handleObject("Sound.rightSample", rightSample);
     ser.handleObject("Sound.regs", regs);
-    ser.handleObject("Sound.timers", timers);
+    ser.handleObject("Sound.channels", channels);
+    ser.handleObject("Sound.sweep", sweep);
+    ser.handleObject("Sound.lfsr", lfsr);
+    ser.handleObject("Sound.sequencerStep", sequencerStep);
+    ser.handleObject("Sound.nextSequencerCycle", nextSequencerCycle);
+    if (!ser.isLoading()) {
+        // Saving leaves both the emulation and the output alone
+        return;
+    }
+
+    if (!synthesis) {
+        // Channel timers are brought back in line when synthesis resumes
+        frameStartCycle = currentCycle;
+        updateNextEvent();
+        return;
+    }
+    restartOutput();
 }
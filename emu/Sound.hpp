@@ -1,10 +1,13 @@
 #pragma once
 
+#include "BlipBuffer.hpp"
 #include "BusUtil.hpp"
 #include "Logger.hpp"
 #include "Platform.hpp"
 #include "Serializer.hpp"
 
+#include <vector>
+
 enum {
     Snd_Ch1_Sweep = 0x10,
     Snd_Ch1_Wave = 0x11,
@@ -44,13 +47,20 @@ union EnvelopeRegs {
 };
 static_assert(sizeof(EnvelopeRegs) == 1, "");
 
-struct TimerState {
-    unsigned long lengthCounterStartCycle;
-    unsigned long frequencyCounterStartCycle;
+// Runtime state of a channel, stepped incrementally by its frequency timer and the frame sequencer
+struct ChannelState {
+    bool enabled;                   // as reported in NR52
+    unsigned lengthCounter;
+    unsigned long nextStepCycle;    // when the frequency timer next expires
+    unsigned position;              // duty step or wave sample index
+    unsigned volume;                // envelope output
+    unsigned envelopeTimer;
+};
 
-    bool lengthTimerRunning() {
-        return lengthCounterStartCycle != 0;
-    }
+struct SweepState {
+    bool enabled;
+    unsigned timer;
+    Word shadowFrequency;
 };
 
 struct FrequencyRegs {
@@ -60,7 +70,7 @@ struct FrequencyRegs {
         struct {
             Byte high : 3;
             Byte _unused : 3;
-            Byte noRestart : 1;
+            Byte lengthEnabled : 1;
             Byte start : 1;
         };
     };
@@ -130,7 +140,7 @@ struct SoundRegs {
             Byte control;
             struct {
                 Byte _unused : 6;
-                Byte noRestart : 1;
+                Byte lengthEnabled : 1;
                 Byte start : 1;
             };
         };
@@ -147,7 +157,7 @@ struct SoundRegs {
             };
         };
         Byte chSel;
-        Byte stat;
+        Byte stat;      // only the power bit is stored, channel bits are read from ChannelState
     } ctrl;
 
     Byte _unused3[9]; // 0xff27 -- 0xff2f
@@ -161,43 +171,136 @@ static_assert(sizeof(SoundRegs::ctrl) == 3, "Control regs incorrect");
 
 static_assert(sizeof(SoundRegs) == (0xff3f - 0xff10 + 1), "Sound regs incorrect");
 
+struct StereoSample {
+    int16_t left;
+    int16_t right;
+};
+static_assert(sizeof(StereoSample) == 4, "StereoSample must be packed");
+
 class Sound {
+    enum {
+        ClockRate = 4194304,
+        BufferSamples = 8192,
+        MaxFrameCycles = 1 << 17,   // blip frames are ended at least this often
+        SequencerCycles = 8192,     // the frame sequencer runs at 512 Hz
+        MixBlockSamples = 512,
+        FadeInSamples = 480,        // 10 ms, when output restarts from silence
+    };
+
+    // An NR50/NR51 write, taking effect from the sample it falls into
+    struct MixChange {
+        unsigned position;      // counted from the next sample read
+        Byte volume;
+        Byte chSel;
+    };
+
     Logger* log;
+    const long* clock;      // current emulated cycle, the APU lags behind it until it catches up
     SoundRegs regs;
-    struct {
-        TimerState ch1;
-        TimerState ch2;
-        TimerState ch3; // no real envelope but used as enable/disable counter
-        TimerState ch4;
-    } timers;
 
     unsigned long currentCycle;
-    long cycleResidue;
-    long currentSampleNumber;
 
-    uint16_t leftSample;
-    uint16_t rightSample;
+    ChannelState channels[4];
+    SweepState sweep;
+    Word lfsr;
+    unsigned sequencerStep;
+    unsigned long nextSequencerCycle;
+
+    // Channel levels only change when a frequency timer expires, the frame sequencer
+    // steps or a register is written
+    int channelLevels[4];
+    unsigned long nextEventCycle;
+
+    // Each channel's level is fed to a blip buffer of its own as deltas. The channels are
+    // mixed into stereo block by block when read.
+    BlipBuffer channelBuffers[4];
+    int bufferLevels[4];
+    unsigned long frameStartCycle;
+    double rateAdjustment;      // applied to the output rate from the next frame on
+
+    // NR50/NR51 as of the next sample read, followed by the writes not read up to yet
+    Byte mixVolume;
+    Byte mixChSel;
+    std::vector<MixChange> mixChanges;
+
+    // Debugging aids, on top of NR50/NR51
+    double channelGains[4];
+    bool channelMuted[4];
+
+    // Without synthesis, only the frame sequencer runs: what games can read back stays
+    // up to date, but channel timers, levels and mixing are skipped
+    bool synthesis;
+    bool requestedSynthesis;    // switched to at the next endFrame()
+    unsigned fadeInRemaining;
+
+    // Hash of the samples read since the last takeSampleHash(), for regression checks
+    bool sampleHashing;
+    uint64_t sampleHash;
+
+    void runUntil(unsigned long cycle);
+    void stepChannel(unsigned channel);
+    void stepSequencer();
+    void clockLength(unsigned channel);
+    void clockEnvelope(unsigned channel);
+    void clockSweep();
+    unsigned sweepFrequency();
+    void trigger(unsigned channel);
+    void powerOff();
+
+    unsigned getPeriod(unsigned channel);
+    bool isDacEnabled(unsigned channel);
+    bool isLengthEnabled(unsigned channel);
+    EnvelopeRegs& getEnvelope(unsigned channel);
+    int getChannelLevel(unsigned channel);
+
+    void updateLevels();
+    void updateOutput();
+    void updateNextEvent();
+    void updateMix();
+    void advanceMix(unsigned count);
+    void getMixGains(int32_t* leftGains, int32_t* rightGains);
+    void endBlipFrame();
+    void restartOutput();
+    void applyFadeIn(StereoSample* samples, unsigned count);
 
 public:
-    Sound(Logger* log);
+    enum {
+        SampleRate = 48000,     // of the samples read, before any rate adjustment
+    };
+
+    Sound(Logger* log, const long* clock);
 
-    void generateSamples();
     void registerAccess(Word address, Byte* pData, bool isWrite);
-    void tick(int cycleDelta);
+    // Runs the APU up to the current cycle. Only needed before its state is looked at,
+    // register accesses and endFrame() do it themselves.
+    void catchUp() { runUntil(*clock); }
 
-    int evalPulseChannel(SquareChannelRegs& regs, TimerState& envelState);
-    int evalWaveChannel();
-    int evalNoiseChannel();
+    // Makes the samples of everything emulated so far readable
+    void endFrame();
+    unsigned samplesAvailable() { return channelBuffers[0].samplesAvailable(); }
+    // Produces slightly more (> 1) or fewer (< 1) samples per emulated second, so that
+    // the frontend can keep its audio buffer level steady
+    void setRateAdjustment(double rateAdjustment) { this->rateAdjustment = rateAdjustment; }
+    // Reads up to count samples, returns the number read. If stems is given, each channel's
+    // output before panning and volume is also written to stems[0] to stems[3].
+    unsigned readSamples(StereoSample* out, unsigned count, int16_t* const* stems = nullptr);
 
-    void restartTimer(TimerState& state);
-    unsigned int evalEnvelope(EnvelopeRegs& regs, TimerState& state);
-    void tickTimer(TimerState& state, Byte curLength, int channelMaxLength, bool noRestart);
+    // Null audio, for when nobody listens: NR52 and the length counters, sweep and envelopes
+    // keep running, but no samples are produced. Takes effect at the next endFrame(), and
+    // synthesis resumes with a short fade-in.
+    void setNullAudio(bool nullAudio) { requestedSynthesis = !nullAudio; }
+    bool isNullAudio() { return !synthesis; }
 
-    int mixVolume(int sample, unsigned int volume);
-    bool evalPulseWaveform(SquareChannelRegs& ch);
+    // Scales a channel in the mix (0 to 4), from the next sample read on
+    void setChannelGain(unsigned channel, double gain);
+    void setChannelMuted(unsigned channel, bool muted) { channelMuted[channel] = muted; }
+    bool isChannelMuted(unsigned channel) { return channelMuted[channel]; }
 
-    long getCurrentSampleNumber() { return currentSampleNumber; }
-    uint16_t getLeftSample() { return leftSample; }
-    uint16_t getRightSample() { return rightSample; }
+    void setSampleHashing(bool sampleHashing) { this->sampleHashing = sampleHashing; }
+    uint64_t takeSampleHash() {
+        uint64_t hash = sampleHash;
+        sampleHash = 0;
+        return hash;
+    }
     void serialize(Serializer& ser);
 };
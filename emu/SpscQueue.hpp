@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+
+// Lock-free ring buffer for exactly one producer thread and one consumer thread.
+// Neither side ever blocks; push() fails when the ring is full.
+template<typename T, std::size_t Size>
+class SpscQueue {
+    static_assert((Size & (Size - 1)) == 0, "SpscQueue size must be a power of two");
+
+    T buf[Size];
+    std::atomic<std::size_t> head;  // only written by the producer
+    std::atomic<std::size_t> tail;  // only written by the consumer
+
+public:
+    SpscQueue() :
+            head(0),
+            tail(0) {
+    }
+
+    bool push(const T& item) {
+        std::size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == Size) {
+            return false;
+        }
+        buf[h % Size] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Pushes as many of the n items as fit, returns how many were pushed
+    std::size_t push(const T* items, std::size_t n) {
+        std::size_t h = head.load(std::memory_order_relaxed);
+        n = std::min(n, Size - (h - tail.load(std::memory_order_acquire)));
+        // The free space wraps around the end of buf at most once
+        std::size_t first = std::min(n, Size - h % Size);
+        std::copy(items, items + first, buf + h % Size);
+        std::copy(items + first, items + n, buf);
+        head.store(h + n, std::memory_order_release);
+        return n;
+    }
+
+    // Pops up to n items into out, returns how many were popped
+    std::size_t pop(T* out, std::size_t n) {
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        n = std::min(n, head.load(std::memory_order_acquire) - t);
+        std::size_t first = std::min(n, Size - t % Size);
+        std::copy(buf + t % Size, buf + t % Size + first, out);
+        std::copy(buf, buf + n - first, out + first);
+        tail.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+    // Returns the oldest item without removing it, or nullptr if empty.
+    T* peek() {
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &buf[t % Size];
+    }
+
+    void pop() {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    std::size_t size() {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+};
@@ -3,6 +3,7 @@
 #include <cassert>
 #include <cstdlib>
 #include <cstdint>
+#include <cstring>
 #include <string>
 
 #define unreachable() assert(!"unreachable()")
@@ -34,3 +35,22 @@ inline std::string replaceExtension(std::string name, const char* extension) {
     }
     return tmp + "." + extension;
 }
+
+// Fast non-cryptographic 64-bit hash, used to compare frames and audio between runs
+inline uint64_t hashBytes(const void* data, std::size_t size, uint64_t seed = 0) {
+    static const uint64_t Multiplier = 0x9e3779b97f4a7c15ULL;
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint64_t h = seed ^ (size * Multiplier);
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        h = (h ^ word) * Multiplier;
+        h ^= h >> 32;
+    }
+    for (; i < size; i++) {
+        h = (h ^ bytes[i]) * Multiplier;
+        h ^= h >> 32;
+    }
+    return h;
+}
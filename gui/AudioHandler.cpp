@@ -7,66 +7,64 @@
 
 using namespace std;
 
-void AudioHandler::feedSamples(int16_t left, int16_t right) {
-    if ((head + 1) % SIZE == tail) {
+// Largest rate change, small enough not to be heard as a pitch change
+static const double MaxRateDeviation = 0.005;
+
+void AudioHandler::feedSamples(const StereoSample* samples, size_t count) {
+    // Beyond the capacity, rate control can't catch up in reasonable time: drop samples instead
+    size_t room = capacity - std::min(capacity, this->samples.size());
+    size_t pushed = this->samples.push(samples, std::min(count, room));
+    if (pushed < count) {
         if (!wasFull) {
             TimingUtils::log() << "Audio buffer full!";
         }
         wasFull = true;
-        return;
+    } else {
+        wasFull = false;
     }
-    // qDebug() << "Sample: " << left;
-    buf[head].left = left;
-    buf[head].right = right;
-    head = (head + 1) % SIZE;
 }
+double AudioHandler::getRateAdjustment() {
+    double fill = samples.size();
+    double error = clamp((targetSamples - fill) / targetSamples, -1.0, 1.0);
+    return 1 + MaxRateDeviation * error;
+}
+
 void AudioHandler::outputStateChanged(QAudio::State state) {
     TimingUtils::log() << "State: " << state << ", error: " << audioOutput->error();
 }
-QAudioFormat AudioHandler::createFormat() {
+QAudioFormat AudioHandler::createFormat(unsigned sampleRate) {
     QAudioFormat f;
 
     f.setCodec("audio/pcm");
     f.setChannelCount(2);
-    f.setSampleRate(48000);
+    f.setSampleRate(sampleRate);
     f.setSampleSize(16);
-    f.setSampleType(QAudioFormat::UnSignedInt);
+    f.setSampleType(QAudioFormat::SignedInt);
     f.setByteOrder(QAudioFormat::LittleEndian);
 
     return f;
 }
 
 qint64 AudioHandler::readData(char* data, qint64 maxLen) {
-    qint64 nSamples = min(qint64(samplesAvailable()), qint64(maxLen / sizeof(Sample)));
-
-    if (!nSamples) {
+    size_t count = samples.pop((StereoSample*)data, maxLen / sizeof(StereoSample));
+    if (!count) {
         // TimingUtils::log() << "Audio buffer underrun: " << maxLen;
-        // memset(data, 0, sizeof(Sample));
-        // return sizeof(Sample);
-        return 0;
     }
-
-    // TimingUtils::log() << "Filling samples: " << nSamples << ", available: " << samplesAvailable();
-    for (qint64 i = 0; i < nSamples; ++i) {
-        memcpy(data, &buf[tail], sizeof(Sample));
-        data += sizeof(Sample);
-        tail = (tail + 1) % SIZE;
-    }
-    wasFull = false;
-
-    return nSamples * sizeof(Sample);
+    return count * sizeof(StereoSample);
 }
 
 qint64 AudioHandler::writeData(const char* data, qint64 len) {
     unreachable();
     return -1;
 }
-AudioHandler::AudioHandler() : format(createFormat()),
+AudioHandler::AudioHandler(unsigned latencyMsecs, unsigned sampleRate) : format(createFormat(sampleRate)),
                                audioOutput(new QAudioOutput(format)),
-                               head(0),
-                               tail(0),
+                               targetSamples(std::max(1u, sampleRate * std::min(latencyMsecs,
+                                       getMaxLatencyMsecs(sampleRate)) / 2000)),
+                               capacity(targetSamples * 4),
                                wasFull(false) {
     connect(audioOutput, SIGNAL(stateChanged(QAudio::State)), this, SLOT(outputStateChanged(QAudio::State)));
+    audioOutput->setBufferSize(targetSamples * sizeof(StereoSample));
     this->open(OpenModeFlag::ReadOnly);
     audioOutput->start(this);
 }
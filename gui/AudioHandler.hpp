@@ -1,5 +1,8 @@
 #pragma once
 
+#include "emu/Sound.hpp"
+#include "emu/SpscQueue.hpp"
+
 #include <QAudioFormat>
 #include <QAudioOutput>
 
@@ -9,20 +12,19 @@ Q_OBJECT
     QAudioOutput* audioOutput;
 
     enum {
-        SIZE = 65536,
+        SIZE = 32768,
     };
 
-    struct Sample {
-        uint16_t left, right;
-    } buf[SIZE];
+    // Filled by the emulation thread, drained by the audio thread
+    SpscQueue<StereoSample, SIZE> samples;
 
-    size_t head;
-    size_t tail;
+    // Half of the latency is spent in the ring, the other half in the audio device buffer
+    size_t targetSamples;
+    size_t capacity;    // the ring is never filled beyond this, 4 times the target
 
-    bool wasFull;
+    bool wasFull;       // only used by the emulation thread
 
-    QAudioFormat createFormat();
-    size_t samplesAvailable() { return (head - tail) % SIZE; }
+    QAudioFormat createFormat(unsigned sampleRate);
 
 private slots:
     void outputStateChanged(QAudio::State st);
@@ -32,7 +34,14 @@ protected:
     virtual qint64 writeData(const char* data, qint64 len);
 
 public:
-    void feedSamples(int16_t left, int16_t right);
+    void feedSamples(const StereoSample* samples, size_t count);
+    size_t samplesAvailable() { return samples.size(); }
+    // Dynamic rate control: how much faster (> 1) or slower (< 1) samples should be produced
+    // to bring the ring back to its target level
+    double getRateAdjustment();
+
+    // Largest latency the ring can hold at sampleRate, larger ones are clamped to it
+    static unsigned getMaxLatencyMsecs(unsigned sampleRate) { return SIZE * 500 / sampleRate; }
 
-    AudioHandler();
+    explicit AudioHandler(unsigned latencyMsecs = 40, unsigned sampleRate = Sound::SampleRate);
 };
@@ -24,8 +24,8 @@ QGLFormat& LcdWidget::createGLFormat() {
     return f;
 }
 
-void LcdWidget::setupTexture(QOpenGLTexture& glTexture) {
-    glTexture.setFormat(QOpenGLTexture::R8U);
+void LcdWidget::setupTexture(QOpenGLTexture& glTexture, LcdTextureFormat format) {
+    glTexture.setFormat(format == Texture_Xrgb8888 ? QOpenGLTexture::RGBA8_UNorm : QOpenGLTexture::R8U);
     glTexture.setMipLevels(1);
     glTexture.setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
     glTexture.allocateStorage();
@@ -44,7 +44,7 @@ void LcdWidget::initializeGL() {
 
     glActiveTexture(GL_TEXTURE0);
     texture.setSize(textureSize.width(), textureSize.height());
-    setupTexture(texture);
+    setupTexture(texture, textureFormat);
 
     vertexShader = new QGLShader(QGLShader::Vertex, this);
     const char* vsrc =
@@ -102,11 +102,40 @@ void LcdWidget::resizeGL(int w, int h) {
     glViewport(0, 0, w, h);
 }
 
+void LcdWidget::uploadRows(unsigned from, unsigned to) {
+    // 0x00RRGGBB words are B, G, R, X bytes in little endian memory
+    bool xrgb = textureFormat == Texture_Xrgb8888;
+    unsigned pitch = textureSize.width() * (xrgb ? 4 : 1);
+
+    texture.bind();
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, from, textureSize.width(), to - from,
+            xrgb ? GL_BGRA : GL_RED_INTEGER, GL_UNSIGNED_BYTE, textureData + from * pitch);
+}
+
 void LcdWidget::paintGL() {
     if (drawCallback) {
         drawCallback(this);
     }
-    texture.setData(QOpenGLTexture::Red_Integer, QOpenGLTexture::UInt8, (void*)textureData);
+    if (!textureData) {
+        // Nothing to show yet
+    } else if (!partialUpload) {
+        uploadRows(0, textureSize.height());
+    } else {
+        // Upload each run of consecutive dirty rows at once
+        unsigned height = textureSize.height();
+        for (unsigned row = 0; row < height; ) {
+            if (!dirtyRows[row]) {
+                row++;
+                continue;
+            }
+            unsigned end = row;
+            while (end < height && dirtyRows[end]) {
+                dirtyRows[end++] = false;
+            }
+            uploadRows(row, end);
+            row = end;
+        }
+    }
     CHECK_GL();
 
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
@@ -4,7 +4,14 @@
 #include <QWidget>
 #include <QGLWidget>
 #include <QtOpenGL>
+#include <algorithm>
 #include <functional>
+#include <vector>
+
+enum LcdTextureFormat {
+    Texture_Bytes,      // raw bytes, fetched by the shader as unsigned integers
+    Texture_Xrgb8888,   // host pixels from Gpu in PixelFormat_Xrgb8888
+};
 
 class LcdWidget : public QGLWidget {
 Q_OBJECT
@@ -15,13 +22,17 @@ Q_OBJECT
     QOpenGLTexture xAxisGridTexture;
     QOpenGLTexture yAxisGridTexture;
 
-    Byte* textureData;
+    const Byte* textureData;
     QSize textureSize;
+    LcdTextureFormat textureFormat;
+    bool partialUpload;             // only upload rows marked dirty, instead of everything on each paint
+    std::vector<bool> dirtyRows;
     char const* fragmentShaderFile;
     std::function<void(LcdWidget*)> drawCallback;
 
     static QGLFormat& createGLFormat();
-    static void setupTexture(QOpenGLTexture& glTexture);
+    static void setupTexture(QOpenGLTexture& glTexture, LcdTextureFormat format);
+    void uploadRows(unsigned from, unsigned to);
 
 protected:
     virtual void initializeGL() override;
@@ -55,14 +66,22 @@ public:
         setFocusPolicy(Qt::StrongFocus);
     }
 
-    void init(Byte* textureData, QSize size, char const* shaderFile,
-            std::function<void(LcdWidget*)> drawCallback = nullptr) {
+    void init(const Byte* textureData, QSize size, char const* shaderFile,
+            std::function<void(LcdWidget*)> drawCallback = nullptr, LcdTextureFormat format = Texture_Bytes) {
         this->textureData = textureData;
         this->textureSize = size;
+        this->textureFormat = format;
+        this->partialUpload = false;
+        this->dirtyRows.assign(size.height(), true);
         this->fragmentShaderFile = shaderFile;
         this->drawCallback = drawCallback;
     }
 
+    void setTextureData(const Byte* textureData) { this->textureData = textureData; }
+    void setPartialUpload(bool partialUpload) { this->partialUpload = partialUpload; }
+    void markRowDirty(unsigned row) { dirtyRows[row] = true; }
+    bool hasDirtyRows() { return std::find(dirtyRows.begin(), dirtyRows.end(), true) != dirtyRows.end(); }
+
     QGLShaderProgram* getShaderProgram() { return shaderProgram; }
 
     virtual ~LcdWidget() {
@@ -57,14 +57,21 @@ void MainWindow::fillDynamicRegisterTables() {
     }
 }
 
-MainWindow::MainWindow(const char* romFile, bool gbc, bool insnTrace, QWidget* parent) :
+MainWindow::MainWindow(const char* romFile, bool gbc, bool insnTrace,
+        FrameSkipMode frameSkip, unsigned frameSkipCount, bool threadedRendering, ScalerType scaler,
+        unsigned audioLatencyMsecs, unsigned audioRate, ResamplerQuality resamplerQuality,
+        const char* audioDumpFile, bool audioDumpStems, const char* inputRecordFile, QWidget* parent) :
         QMainWindow(parent),
         ui(new Ui::MainWindow),
+        audioHandler(audioLatencyMsecs, audioRate),
         log(ui.get()),
         rom(&log, romFile),
         gb(&log, &rom, gbc),
         frameTimer(new QTimer(this)) {
     setFocusPolicy(Qt::StrongFocus);
+    if (audioRate != Sound::SampleRate) {
+        resampler.reset(new Resampler(Sound::SampleRate, audioRate, resamplerQuality));
+    }
 
     ui->setupUi(this);
     fillDynamicRegisterTables();
@@ -72,12 +79,19 @@ MainWindow::MainWindow(const char* romFile, bool gbc, bool insnTrace, QWidget* p
     connect(ui->lcdWidget, SIGNAL(focusChanged(bool)), this, SLOT(lcdFocusChanged(bool)));
     connect(ui->lcdWidget, SIGNAL(keyEvent(QKeyEvent * )), this, SLOT(lcdKeyEvent(QKeyEvent * )));
 
-    // XXX: this cast & * 2 is a HACK
-    ui->lcdWidget->init((Byte*)gb.getGpu()->getFramebuffer(), QSize(ScreenWidth * 2, ScreenHeight), "main.frag");
+    gb.getGpu()->setPixelFormat(PixelFormat_Xrgb8888);
+    if (scaler != Scaler_None) {
+        scalerThread.reset(new ScalerThread(scaler, gb.getGpu()->getFrameExchange()));
+    }
+    unsigned scale = Scalers::getScaleFactor(scaler);
+    ui->lcdWidget->init(nullptr, QSize(ScreenWidth * scale, ScreenHeight * scale), "main.frag",
+            nullptr, Texture_Xrgb8888);
+    ui->lcdWidget->setPartialUpload(true);
     ui->lcdWidget->setFocus();
 
     Gpu* gpu = gb.getGpu();
-    // FIXME(maybe): vram is copied to texture memory twice
+    // FIXME(maybe): vram is copied to texture memory twice when both viewers are shown.
+    // The viewers only upload it in updateDebugViewers(), not on every Qt repaint.
     ui->patternViewerLcdWidget->init(gb.getGpu()->getVram(), QSize(8192, 1), "patternViewer.frag");
     ui->tileMapViewerLcdWidget->init(gb.getGpu()->getVram(), QSize(8192, 1), "tilemapViewer.frag",
             [ gpu ](LcdWidget* tilemapViewer) {
@@ -85,61 +99,152 @@ MainWindow::MainWindow(const char* romFile, bool gbc, bool insnTrace, QWidget* p
                 tilemapShader->setUniformValue("bgPatternBaseSelect", (int)gpu->getRegs()->bgPatternBaseSelect);
                 tilemapShader->setUniformValue("bgTileBaseSelect", (int)gpu->getRegs()->bgTileBaseSelect);
             });
+    ui->patternViewerLcdWidget->setPartialUpload(true);
+    ui->tileMapViewerLcdWidget->setPartialUpload(true);
+    std::memset(&patternViewerGenerations, 0xff, sizeof(patternViewerGenerations));
+    std::memset(&tileMapViewerGenerations, 0xff, sizeof(tileMapViewerGenerations));
     updateRegisters();
 
     log.insnLoggingEnabled = insnTrace;
 
+    if (inputRecordFile) {
+        // From power on, like the regression runner replays it
+        inputRecord.open(inputRecordFile);
+        if (!inputRecord) {
+            throw "Can't open input record file";
+        }
+        inputRecord << "# " << rom.getFileName() << (gbc ? " cgb" : " dmg") << "\n";
+        gb.getJoypad()->setRecording(true);
+    }
+
     // Skip BootRom
     gb.getGpu()->setRenderEnabled(false);
     while (gb.getGpu()->getCurrentFrame() != 332) {
         gb.runOneInstruction();
     }
     gb.getGpu()->setRenderEnabled(true);
+    // Nor is its sound played
+    gb.getSound()->endFrame();
+    StereoSample samples[1024];
+    while (gb.getSound()->readSamples(samples, 1024)) {
+    }
+    if (audioDumpFile) {
+        audioDumper.reset(new AudioDumper(audioDumpFile, Sound::SampleRate, audioDumpStems));
+    }
+    gb.getGpu()->getFrameSkipper()->setMode(frameSkip, frameSkipCount);
+    gb.getGpu()->setThreadedRendering(threadedRendering);
 
     connect(frameTimer, SIGNAL(timeout()), this, SLOT(timerTick()));
     nextRenderAt = TimingUtils::getNsecs();
     frameTimer->start(0);
 }
 
+void MainWindow::feedAudio() {
+    Sound* snd = gb.getSound();
+    snd->endFrame();
+
+    StereoSample samples[1024];
+    int16_t channels[4][1024];
+    int16_t* channelPtrs[] = { channels[0], channels[1], channels[2], channels[3] };
+    bool stems = audioDumper && audioDumper->hasStems();
+    while (unsigned count = snd->readSamples(samples, 1024, stems ? channelPtrs : nullptr)) {
+        if (audioDumper) {
+            // At the APU's rate, before resampling
+            audioDumper->write(samples, channelPtrs, count);
+        }
+        if (!resampler) {
+            audioHandler.feedSamples(samples, count);
+            continue;
+        }
+        resampler->write(samples, count);
+        StereoSample resampled[2048];
+        while (unsigned resampledCount = resampler->read(resampled, 2048)) {
+            audioHandler.feedSamples(resampled, resampledCount);
+        }
+    }
+    // The APU rate is adjusted, so the resampler keeps converting at a fixed ratio
+    snd->setRateAdjustment(audioHandler.getRateAdjustment());
+}
+
+void MainWindow::recordInput() {
+    for (const JoypadEvent& event : gb.getJoypad()->takeRecordedEvents()) {
+        inputRecord << Joypad::formatEvent(event) << "\n";
+    }
+    inputRecord.flush();
+}
+
 void MainWindow::timerTick() {
     Gpu* gpu = gb.getGpu();
-    Sound* snd = gb.getSound();
 
     long startTime = TimingUtils::getNsecs();
     long overtime = clamp(startTime - nextRenderAt, -FrameNsecs / 20, FrameNsecs / 20);
 
-    long frame = gpu->getCurrentFrame();
-    long sample = snd->getCurrentSampleNumber();
-    // TimingUtils::log() << "Frame start, audio sample: " << snd->getCurrentSampleNumber();
-    while (true) {
-        gb.runOneInstruction();
+    gb.runFrame();
 
-        if (snd->getCurrentSampleNumber() != sample) {
-            audioHandler.feedSamples(snd->getLeftSample(), snd->getRightSample());
-            sample = snd->getCurrentSampleNumber();
-        }
+    feedAudio();
+    if (inputRecord.is_open()) {
+        recordInput();
+    }
 
-        if (gpu->getCurrentFrame() != frame) {
-            break;
+    // Only lines that differ from what is on screen are uploaded, and unchanged frames
+    // (including skipped ones) aren't repainted at all
+    if (scalerThread) {
+        // Shows the latest frame the scaler has finished, i.e. usually the previous one
+        scalerThread->notifyFrame();
+        std::bitset<ScreenHeight * 3> dirtyLines;
+        ui->lcdWidget->setTextureData(scalerThread->getOutput()->acquire(dirtyLines));
+        for (unsigned i = 0; i < ScreenHeight * scalerThread->getScaleFactor(); i++) {
+            if (dirtyLines[i]) {
+                ui->lcdWidget->markRowDirty(i);
+            }
+        }
+    } else {
+        std::bitset<ScreenHeight> dirtyLines;
+        ui->lcdWidget->setTextureData(gpu->getFrameExchange()->acquire(dirtyLines));
+        for (unsigned i = 0; i < ScreenHeight; i++) {
+            if (dirtyLines[i]) {
+                ui->lcdWidget->markRowDirty(i);
+            }
         }
     }
-    // TimingUtils::log() << "Frame over, audio sample: " << snd->getCurrentSampleNumber() << ", available: " << audioHandler.samplesAvailable();
-
-    ui->lcdWidget->repaint();
-    ui->patternViewerLcdWidget->repaint();
-    ui->tileMapViewerLcdWidget->repaint();
+    if (ui->lcdWidget->hasDirtyRows()) {
+        ui->lcdWidget->repaint();
+    }
+    updateDebugViewers();
 
     if (gb.getGpu()->getCurrentFrame() % 60 == 0) {
         updateRegisters();
     }
 
     long endTime = TimingUtils::getNsecs();
+    gpu->getFrameSkipper()->reportHostFrameTime(endTime - startTime, FrameNsecs);
     nextRenderAt = startTime - overtime + FrameNsecs;
     long msec = (nextRenderAt - endTime) / 1000000;
     // qDebug() << "msec: " << msec << "overtime: " << overtime;
     frameTimer->start(msec < 0 ? 0 : msec);
 }
 
+void MainWindow::updateDebugViewers() {
+    // Viewers in a hidden tab are skipped; their stale generations make them
+    // upload as soon as they are shown again
+    const GpuGenerations& current = gb.getGpu()->getGenerations();
+    LcdWidget* patternViewer = ui->patternViewerLcdWidget;
+    if (patternViewer->isVisible() && (current.vram != patternViewerGenerations.vram ||
+            current.palettes != patternViewerGenerations.palettes)) {
+        patternViewerGenerations = current;
+        patternViewer->markRowDirty(0);
+        patternViewer->repaint();
+    }
+    LcdWidget* tileMapViewer = ui->tileMapViewerLcdWidget;
+    if (tileMapViewer->isVisible() && (current.vram != tileMapViewerGenerations.vram ||
+            current.tileMapSelect != tileMapViewerGenerations.tileMapSelect ||
+            current.palettes != tileMapViewerGenerations.palettes)) {
+        tileMapViewerGenerations = current;
+        tileMapViewer->markRowDirty(0);
+        tileMapViewer->repaint();
+    }
+}
+
 void MainWindow::lcdFocusChanged(bool in) {
     if (in) {
         frameTimer->start();
@@ -187,6 +292,15 @@ void MainWindow::lcdKeyEvent(QKeyEvent* e) {
                 loadGameState();
             }
             return;
+        case Qt::Key_1:
+        case Qt::Key_2:
+        case Qt::Key_3:
+        case Qt::Key_4:
+            if (e->type() == QEvent::KeyPress) {
+                unsigned channel = e->key() - Qt::Key_1;
+                gb.getSound()->setChannelMuted(channel, !gb.getSound()->isChannelMuted(channel));
+            }
+            return;
 
         default:
             return;
@@ -219,6 +333,11 @@ void MainWindow::updateRegisters() {
         pend->setChecked(irqsPending & mask);
     }
 
+    FrameSkipper* frameSkipper = gb.getGpu()->getFrameSkipper();
+    if (frameSkipper->getMode() != FrameSkip_Off) {
+        setWindowTitle(QString("YAGB - %1 frames skipped").arg(frameSkipper->getSkippedFrames()));
+    }
+
     Regs* regs = gb.getCpu()->getRegs();
     ui->cpuRegsAf->setHex(regs->af);
     ui->cpuRegsBc->setHex(regs->bc);
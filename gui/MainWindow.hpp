@@ -1,14 +1,18 @@
 #pragma once
 
+#include "emu/AudioDumper.hpp"
 #include "emu/Gameboy.hpp"
 #include "emu/Logger.hpp"
+#include "emu/Resampler.hpp"
 #include "emu/Rom.hpp"
 #include "AudioHandler.hpp"
+#include "ScalerThread.hpp"
 
 #include <QMainWindow>
 #include <QPixmap>
 #include <QPlainTextEdit>
 #include <QTimer>
+#include <fstream>
 #include <memory>
 
 namespace Ui { class MainWindow; }
@@ -28,22 +32,38 @@ class MainWindow : public QMainWindow {
 Q_OBJECT
 
 public:
-    explicit MainWindow(const char* romFile, bool gbc, bool insnTrace, QWidget* parent = 0);
+    explicit MainWindow(const char* romFile, bool gbc, bool insnTrace,
+            FrameSkipMode frameSkip = FrameSkip_Off, unsigned frameSkipCount = 0, bool threadedRendering = false,
+            ScalerType scaler = Scaler_None, unsigned audioLatencyMsecs = 40,
+            unsigned audioRate = Sound::SampleRate, ResamplerQuality resamplerQuality = Resampler_Medium,
+            const char* audioDumpFile = nullptr, bool audioDumpStems = false,
+            const char* inputRecordFile = nullptr, QWidget* parent = 0);
     ~MainWindow();
 
 private:
     std::unique_ptr<Ui::MainWindow> ui;
     AudioHandler audioHandler;
+    std::unique_ptr<Resampler> resampler;     // only when the host rate differs from the APU's
 
     GuiLogger log;
     Rom rom;
     Gameboy gb;
+    std::unique_ptr<ScalerThread> scalerThread;
+    std::unique_ptr<AudioDumper> audioDumper;
+    std::ofstream inputRecord;      // key events, in the regression runner's input file format
+
+    // Gpu state last uploaded by each debug viewer
+    GpuGenerations patternViewerGenerations;
+    GpuGenerations tileMapViewerGenerations;
 
     long nextRenderAt;
     QTimer* frameTimer;
 
     void fillDynamicRegisterTables();
     void updateRegisters();
+    void updateDebugViewers();
+    void feedAudio();
+    void recordInput();
 
 private slots:
     void timerTick();
@@ -0,0 +1,73 @@
+#include "ScalerThread.hpp"
+
+ScalerThread::ScalerThread(ScalerType type, LcdFrameExchange* input) :
+        type(type),
+        factor(Scalers::getScaleFactor(type)),
+        input(input),
+        scaled(ScreenWidth * factor * ScreenHeight * factor),
+        frameReady(false),
+        quit(false),
+        thread(&ScalerThread::run, this) {
+}
+
+ScalerThread::~ScalerThread() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wakeup.notify_one();
+    thread.join();
+}
+
+// Called after the core has published a frame
+void ScalerThread::notifyFrame() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        frameReady = true;
+    }
+    wakeup.notify_one();
+}
+
+void ScalerThread::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wakeup.wait(lock, [this] { return frameReady || quit; });
+        if (quit) {
+            return;
+        }
+        frameReady = false;
+        lock.unlock();
+
+        std::bitset<ScreenHeight> dirtyLines;
+        const uint32_t* frame = (const uint32_t*)input->acquire(dirtyLines);
+        if (dirtyLines.any()) {
+            scaleFrame(frame, dirtyLines);
+        }
+
+        lock.lock();
+    }
+}
+
+void ScalerThread::scaleFrame(const uint32_t* frame, const std::bitset<ScreenHeight>& dirtyLines) {
+    // The filters look at the rows above and below, so those change as well
+    std::bitset<ScreenHeight> rows = dirtyLines | (dirtyLines << 1) | (dirtyLines >> 1);
+    std::bitset<ScreenHeight * 3> scaledRows;
+
+    for (unsigned y = 0; y < ScreenHeight; ) {
+        if (!rows[y]) {
+            y++;
+            continue;
+        }
+        unsigned end = y;
+        while (end < ScreenHeight && rows[end]) {
+            for (unsigned k = 0; k < factor; k++) {
+                scaledRows.set(end * factor + k);
+            }
+            end++;
+        }
+        Scalers::scale(type, frame, ScreenWidth, ScreenHeight, &scaled[0], y, end);
+        y = end;
+    }
+
+    output.publish((const Byte*)&scaled[0], scaledRows, scaled.size() * sizeof(uint32_t));
+}
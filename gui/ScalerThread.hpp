@@ -0,0 +1,40 @@
+#pragma once
+
+#include "emu/FrameExchange.hpp"
+#include "emu/Gpu.hpp"
+#include "emu/Scalers.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Big enough for the largest scale factor, smaller frames only fill the start of each buffer
+typedef FrameExchange<ScreenWidth * 3 * ScreenHeight * 3 * 4, ScreenHeight * 3> ScaledFrameExchange;
+
+// Upscales each frame the core publishes on a separate thread, and publishes the result
+// for the frontend. Only XRGB8888 frames can be scaled.
+class ScalerThread {
+    ScalerType type;
+    unsigned factor;
+    LcdFrameExchange* input;
+    ScaledFrameExchange output;
+    std::vector<uint32_t> scaled;   // kept between frames, only changed rows are scaled again
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool frameReady;
+    bool quit;
+    std::thread thread;
+
+    void run();
+    void scaleFrame(const uint32_t* frame, const std::bitset<ScreenHeight>& dirtyLines);
+
+public:
+    ScalerThread(ScalerType type, LcdFrameExchange* input);
+    ~ScalerThread();
+
+    void notifyFrame();
+    unsigned getScaleFactor() { return factor; }
+    ScaledFrameExchange* getOutput() { return &output; }
+};
@@ -1,6 +1,8 @@
 #include "MainWindow.hpp"
 
 #include <QApplication>
+#include <cstdlib>
+#include <cstring>
 #include <unistd.h>
 
 int main(int argc, char** argv) {
@@ -8,8 +10,18 @@ int main(int argc, char** argv) {
 
     bool gbc = false;
     bool trace = false;
+    FrameSkipMode frameSkip = FrameSkip_Off;
+    unsigned frameSkipCount = 0;
+    bool threadedRendering = false;
+    ScalerType scaler = Scaler_None;
+    unsigned audioLatency = 40;
+    unsigned audioRate = Sound::SampleRate;
+    ResamplerQuality resamplerQuality = Resampler_Medium;
+    const char* audioDumpFile = nullptr;
+    bool audioDumpStems = false;
+    const char* inputRecordFile = nullptr;
     int opt;
-    while ((opt = getopt(argc, argv, "ct")) != -1) {
+    while ((opt = getopt(argc, argv, "ctpsf:x:l:r:q:w:i:")) != -1) {
         switch (opt) {
             case 'c':
                 gbc = true;
@@ -17,15 +29,79 @@ int main(int argc, char** argv) {
             case 't':
                 trace = true;
                 break;
+            case 'p':
+                threadedRendering = true;
+                break;
+            case 's':
+                audioDumpStems = true;
+                break;
+            case 'w':
+                audioDumpFile = optarg;
+                break;
+            case 'i':
+                inputRecordFile = optarg;
+                break;
+            case 'x':
+                if (!strcmp(optarg, "scale2x")) {
+                    scaler = Scaler_Scale2x;
+                } else if (!strcmp(optarg, "scale3x")) {
+                    scaler = Scaler_Scale3x;
+                } else if (!strcmp(optarg, "hq2x")) {
+                    scaler = Scaler_Hq2x;
+                } else {
+                    fprintf(stderr, "unknown scaler: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'l':
+                audioLatency = atoi(optarg);
+                if (!audioLatency) {
+                    fprintf(stderr, "invalid audio latency: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'r':
+                audioRate = atoi(optarg);
+                if (audioRate < 8000 || audioRate > 192000) {
+                    fprintf(stderr, "invalid audio rate: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'q':
+                if (!strcmp(optarg, "fast")) {
+                    resamplerQuality = Resampler_Fast;
+                } else if (!strcmp(optarg, "medium")) {
+                    resamplerQuality = Resampler_Medium;
+                } else if (!strcmp(optarg, "best")) {
+                    resamplerQuality = Resampler_Best;
+                } else {
+                    fprintf(stderr, "unknown resampler quality: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'f':
+                if (!strcmp(optarg, "auto")) {
+                    frameSkip = FrameSkip_Adaptive;
+                } else {
+                    frameSkipCount = atoi(optarg);
+                    frameSkip = frameSkipCount ? FrameSkip_Fixed : FrameSkip_Off;
+                }
+                break;
             default:
-                fprintf(stderr, "usage: %s [-t] [-c] [rom]\n", argv[0]);
+                fprintf(stderr, "usage: %s [-t] [-c] [-p] [-f N|auto] [-x scale2x|scale3x|hq2x] [-l msecs] [-r rate] [-q fast|medium|best] [-w dump.wav [-s]] [-i input.txt] [rom]\n", argv[0]);
                 return 1;
         }
     }
+    if (audioLatency > AudioHandler::getMaxLatencyMsecs(audioRate)) {
+        fprintf(stderr, "audio latency can't exceed %u ms at %u Hz\n", AudioHandler::getMaxLatencyMsecs(audioRate),
+                audioRate);
+        return 1;
+    }
     const char* file = optind >= argc ? "test.bin" : argv[optind];
 
     try {
-        MainWindow main(file, gbc, trace);
+        MainWindow main(file, gbc, trace, frameSkip, frameSkipCount, threadedRendering, scaler, audioLatency,
+                audioRate, resamplerQuality, audioDumpFile, audioDumpStems, inputRecordFile);
         main.show();
 
         return app.exec();
@@ -0,0 +1,357 @@
+// Runs ROMs headless and compares hashes of their video and audio output against
+// known good values, to check that optimizations don't change what is emulated.
+//
+// Usage: regression_runner [-j threads] [-p] [-n] [-t trace_dir] [-w dump_dir [-s]] [-u] manifest
+//
+// Each manifest line is an entry:
+//
+//     rom  input|-  dmg|cgb  frames  hash|-
+//
+// Paths are relative to the manifest. The hash chains the per-frame video and audio
+// hashes of all frames up to `frames`. Video hashes cover the colors the game set, not
+// the host pixels, so they don't depend on the pixel format or color correction. With -u,
+// the manifest is rewritten with the hashes of this run. With -t, a per-frame trace of
+// each entry is written (with -u) or compared against (otherwise) to find the first
+// diverging frame. With -n, sound isn't synthesized (null audio), so the audio hashes are
+// empty and only video is checked; like threaded rendering (-p), that needs a manifest of
+// its own. With -w, the sound output of each entry is dumped to a WAV file in dump_dir,
+// named like its trace, and with -s also each channel on its own.
+//
+// Input files hold one joypad event per line: `cycle press|release key[+key...]`,
+// with keys among right, left, up, down, a, b, select and start. The GUI records
+// such files with -i.
+
+#include "emu/AudioDumper.hpp"
+#include "emu/Gameboy.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+class NullLogger : public Logger {
+protected:
+    virtual void logImpl(const char* format, ...) override {
+    }
+};
+
+struct RunOptions {
+    bool threadedRendering;
+    bool nullAudio;
+    std::string dumpDir;
+    bool dumpStems;
+};
+
+struct FrameHashes {
+    uint64_t video;
+    uint64_t audio;
+};
+
+struct Entry {
+    std::string rom;
+    std::string input;
+    bool gbc;
+    long frames;
+    std::string expectedHash;
+
+    std::string hash;
+    std::vector<FrameHashes> trace;
+    std::string error;
+};
+
+static std::string formatHash(uint64_t hash) {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)hash);
+    return buf;
+}
+
+static std::string resolvePath(const std::string& base, const std::string& path) {
+    if (path.empty() || path[0] == '/') {
+        return path;
+    }
+    size_t slash = base.find_last_of('/');
+    return slash == std::string::npos ? path : base.substr(0, slash + 1) + path;
+}
+
+static std::string entryFileName(const std::string& dir, const Entry& entry, const char* extension) {
+    std::string name = entry.rom + "." + (entry.gbc ? "cgb" : "dmg");
+    if (entry.input != "-") {
+        name += "." + entry.input;
+    }
+    for (char& c : name) {
+        if (c == '/') {
+            c = '_';
+        }
+    }
+    return dir + "/" + name + extension;
+}
+
+static std::vector<JoypadEvent> readInputFile(const std::string& fileName) {
+    std::ifstream stream(fileName);
+    if (!stream) {
+        throw "Can't open input file";
+    }
+
+    std::vector<JoypadEvent> events;
+    std::string line;
+    while (std::getline(stream, line)) {
+        JoypadEvent event;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        if (!Joypad::parseEvent(line, &event)) {
+            throw "Malformed input file";
+        }
+        if (!events.empty() && event.cycle < events.back().cycle) {
+            throw "Input events out of order";
+        }
+        events.push_back(event);
+    }
+    return events;
+}
+
+static void runEntry(const std::string& manifest, const RunOptions& options, Entry& entry) {
+    std::vector<JoypadEvent> events;
+    if (entry.input != "-") {
+        events = readInputFile(resolvePath(manifest, entry.input));
+    }
+
+    std::string romFile = resolvePath(manifest, entry.rom);
+    NullLogger log;
+    Rom rom(&log, romFile.c_str(), false);
+    Gameboy gb(&log, &rom, entry.gbc);
+    Gpu* gpu = gb.getGpu();
+    Sound* sound = gb.getSound();
+    gpu->setFrameHashing(true);
+    gpu->setThreadedRendering(options.threadedRendering);
+    sound->setSampleHashing(true);
+    sound->setNullAudio(options.nullAudio);
+
+    std::unique_ptr<AudioDumper> dumper;
+    if (!options.dumpDir.empty()) {
+        dumper.reset(new AudioDumper(entryFileName(options.dumpDir, entry, ".wav"), Sound::SampleRate,
+                options.dumpStems));
+    }
+    int16_t channels[4][1024];
+    int16_t* channelPtrs[] = { channels[0], channels[1], channels[2], channels[3] };
+
+    uint64_t hash = 0;
+    size_t nextEvent = 0;
+    for (long i = 0; i < entry.frames; i++) {
+        // The joypad queue is small, so events are handed over as room frees up
+        while (nextEvent < events.size() && gb.queueInputEvent(events[nextEvent])) {
+            nextEvent++;
+        }
+
+        gb.runFrame();
+
+        sound->endFrame();
+        StereoSample samples[1024];
+        while (unsigned count = sound->readSamples(samples, 1024, dumper && options.dumpStems ? channelPtrs : nullptr)) {
+            if (dumper) {
+                dumper->write(samples, channelPtrs, count);
+            }
+        }
+
+        FrameHashes frameHashes = { gpu->getFrameHash(), sound->takeSampleHash() };
+        hash = hashBytes(&frameHashes, sizeof(frameHashes), hash);
+        entry.trace.push_back(frameHashes);
+    }
+    entry.hash = formatHash(hash);
+
+    if (dumper && !dumper->finish()) {
+        throw "Can't write audio dump";
+    }
+}
+
+static std::vector<FrameHashes> readTrace(const std::string& fileName) {
+    std::vector<FrameHashes> trace;
+    std::ifstream stream(fileName);
+    unsigned long long video, audio;
+    std::string line;
+    while (std::getline(stream, line) && sscanf(line.c_str(), "%llx %llx", &video, &audio) == 2) {
+        trace.push_back(FrameHashes { video, audio });
+    }
+    return trace;
+}
+
+static void writeTrace(const std::string& fileName, const std::vector<FrameHashes>& trace) {
+    std::ofstream stream(fileName);
+    for (const FrameHashes& frameHashes : trace) {
+        stream << formatHash(frameHashes.video) << " " << formatHash(frameHashes.audio) << "\n";
+    }
+    if (!stream) {
+        throw "Can't write trace file";
+    }
+}
+
+// Describes where a mismatching run first diverged from its golden trace
+static std::string describeDivergence(const std::string& traceDir, const Entry& entry) {
+    if (traceDir.empty()) {
+        return "no trace to locate the first diverging frame";
+    }
+    std::vector<FrameHashes> golden = readTrace(entryFileName(traceDir, entry, ".trace"));
+    for (size_t i = 0; i < golden.size() && i < entry.trace.size(); i++) {
+        bool video = golden[i].video != entry.trace[i].video;
+        bool audio = golden[i].audio != entry.trace[i].audio;
+        if (video || audio) {
+            return "first diverging frame " + std::to_string(i) + " (" +
+                    (video && audio ? "video and audio" : video ? "video" : "audio") + ")";
+        }
+    }
+    return "no diverging frame in trace";
+}
+
+static std::vector<Entry> readManifest(const std::string& fileName) {
+    std::ifstream stream(fileName);
+    if (!stream) {
+        throw "Can't open manifest";
+    }
+
+    std::vector<Entry> entries;
+    std::string line;
+    while (std::getline(stream, line)) {
+        std::stringstream fields(line);
+        Entry entry;
+        std::string model;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        if (!(fields >> entry.rom >> entry.input >> model >> entry.frames >> entry.expectedHash) ||
+                (model != "dmg" && model != "cgb") || entry.frames <= 0) {
+            throw "Malformed manifest";
+        }
+        entry.gbc = model == "cgb";
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+static void writeManifest(const std::string& fileName, const std::vector<Entry>& entries) {
+    // Comments and blank lines are kept, entry lines are replaced in order
+    std::vector<std::string> lines;
+    {
+        std::ifstream stream(fileName);
+        std::string line;
+        while (std::getline(stream, line)) {
+            lines.push_back(line);
+        }
+    }
+
+    std::ofstream stream(fileName);
+    size_t entry = 0;
+    for (const std::string& line : lines) {
+        if (line.empty() || line[0] == '#' || entry == entries.size()) {
+            stream << line << "\n";
+            continue;
+        }
+        const Entry& e = entries[entry++];
+        stream << e.rom << " " << e.input << " " << (e.gbc ? "cgb" : "dmg") << " " << e.frames << " "
+                << (e.hash.empty() ? e.expectedHash : e.hash) << "\n";
+    }
+    if (!stream) {
+        throw "Can't write manifest";
+    }
+}
+
+int main(int argc, char** argv) {
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    RunOptions options = { false, false, "", false };
+    bool update = false;
+    std::string traceDir;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:pnst:uw:")) != -1) {
+        switch (opt) {
+            case 'j':
+                threads = std::max(1, atoi(optarg));
+                break;
+            case 'p':
+                options.threadedRendering = true;
+                break;
+            case 'n':
+                options.nullAudio = true;
+                break;
+            case 's':
+                options.dumpStems = true;
+                break;
+            case 't':
+                traceDir = optarg;
+                break;
+            case 'u':
+                update = true;
+                break;
+            case 'w':
+                options.dumpDir = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-j threads] [-p] [-n] [-t trace_dir] [-w dump_dir [-s]] [-u] manifest\n", argv[0]);
+                return 2;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-j threads] [-p] [-n] [-t trace_dir] [-w dump_dir [-s]] [-u] manifest\n", argv[0]);
+        return 2;
+    }
+    if (options.nullAudio && !options.dumpDir.empty()) {
+        fprintf(stderr, "%s: there is no sound to dump with null audio\n", argv[0]);
+        return 2;
+    }
+    std::string manifest = argv[optind];
+
+    try {
+        std::vector<Entry> entries = readManifest(manifest);
+
+        std::atomic<size_t> nextEntry(0);
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < std::min<size_t>(threads, entries.size()); i++) {
+            workers.emplace_back([&]() {
+                for (size_t j; (j = nextEntry++) < entries.size(); ) {
+                    try {
+                        runEntry(manifest, options, entries[j]);
+                    } catch (const char* msg) {
+                        entries[j].error = msg;
+                    }
+                }
+            });
+        }
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+
+        unsigned failed = 0;
+        for (Entry& entry : entries) {
+            std::string name = entry.rom + " (" + (entry.gbc ? "cgb" : "dmg") +
+                    (entry.input != "-" ? ", " + entry.input : "") + ", " + std::to_string(entry.frames) + " frames)";
+            if (!entry.error.empty()) {
+                printf("ERROR %s: %s\n", name.c_str(), entry.error.c_str());
+                failed++;
+            } else if (update) {
+                if (!traceDir.empty()) {
+                    writeTrace(entryFileName(traceDir, entry, ".trace"), entry.trace);
+                }
+                printf("%s %s\n", entry.hash == entry.expectedHash ? "SAME " : "NEW  ", name.c_str());
+            } else if (entry.hash != entry.expectedHash) {
+                printf("FAIL  %s: got %s, %s\n", name.c_str(), entry.hash.c_str(),
+                        describeDivergence(traceDir, entry).c_str());
+                failed++;
+            } else {
+                printf("PASS  %s\n", name.c_str());
+            }
+        }
+        if (update) {
+            writeManifest(manifest, entries);
+        }
+
+        printf("%zu entries, %u failed\n", entries.size(), failed);
+        return failed ? 1 : 0;
+    } catch (const char* msg) {
+        fprintf(stderr, "error: %s\n", msg);
+        return 2;
+    }
+}
@@ -1,4 +1,4 @@
-CONFIG += qt debug silent
+CONFIG += qt debug silent thread
 QT += core gui widgets multimedia opengl
 QMAKE_CXXFLAGS += -std=c++0x -O0 -gdwarf-2 -Wall -Wextra -Woverloaded-virtual -Werror -Wno-unused-parameter -Wno-unknown-pragmas
 